@@ -30,16 +30,36 @@ It handles immediate A2D measurements on several pins
 
 */
 
-#include "msp430g2553.h"
+#include "hal.h"
 #include "stdbool.h"
+#include "stdint.h"
+#include "string.h"
 
 #define		Bit_time	1667//1548     // 9600 Baud, SMCLK=16MHz (16MHz/9600)=1667
-#define		Bit_time_5	833//733      // Time for half a bit.
-#define		Bit_time_RX 1667		// reduced Bit_time for interrupt processing time
-#define		Bit_time_RX_Initial 1667; // add 10 bits to Bit_time for processing adjustment (Falling edge of Start Bit + processing Time + Bit_time is the center of the first Bit)
+
+// Baud rate tables, indexed 0=9600 1=19200 2=38400 3=57600 4=115200, SMCLK=16MHz
+// http://e2e.ti.com/support/microcontrollers/msp430/f/166/t/18687.aspx
+#define		UART_RATES	5				// Controller USCI rates
+#define		BUS_RATES	2				// Software UART rates on the bus, at 38400 and 57600 the start bit capture and TIMER0_A0_ISR
+										// would get ~400 and ~280 cycles per bit, which has not been measured on hardware
+const unsigned int UartDivisor[UART_RATES] = {1666, 833, 416, 277, 138};	// UCA0BR1:UCA0BR0
+const unsigned char UartModulation[UART_RATES] = {UCBRS_6, UCBRS_2, UCBRS_6, UCBRS_7, UCBRS_7};
+const unsigned int BusBitTime[BUS_RATES] = {1667, 833};		// 16MHz/baud
+#define		BAUD_CONFIRM_TICKS	61		// ~2s of Timer1_A overflows for the controller to confirm a new rate
+#define		UART_ERROR_LIMIT	8		// Framing errors before the controller link falls back to 9600
+
+#define		SC		31		// Special Character bounding and separating redundant serf data
+
+#define		BUS_OK			0		// BusTransaction() results
+#define		BUS_ERROR		1		// Redundant data did not match, SendBuf holds "ERROR"
+#define		BUS_TIMEOUT		2		// No CR received, SendBuf holds whatever arrived
+
+#define		TICKS_PER_US	2		// Timer1_A time base runs from SMCLK/8 = 2MHz
+#define		CharGap_us		20000	// Once a reply has started, stop waiting if no character arrives for this long
 
 #define		TXD		BIT5    // TXD on P1.5
-#define		RXD		BIT6    // RXD on P1.6
+#define		RXD		BIT6    // RXD on P1.6, read through Comparator_A+ (CA6)
+#define		RX_CAPTURE	(CM_2 + CCIS_1 + SCS + CAP)	// Timer0_A CCR1 latches TAR on the falling CAOUT (CCI1B) edge of a start bit
 
 #define		FWType1			'M'	// Master
 #define		FWType0			'C'	// Control Power
@@ -48,64 +68,336 @@ It handles immediate A2D measurements on several pins
 #define		ID				'~'
 
 bool bRXBit;				 	// a bit is being received
-bool bRXByte;					// a byte has been received
-bool bStopbit;					// capture rising edge of StopBit
-unsigned int TXByte;			// Byte for Transmit()
-unsigned int RXByte;			// Received byte
+unsigned int TXByte;			// Bits of the byte being sent, start and stop bit included
+unsigned char RXByte;			// Received byte
 unsigned char cBit;				// Counter for transmitting a byte
-
-char CmdBuf[]="                              ";     // Buffer to store received command and parameters
+char *pTxFrame;					// Next byte of the frame TIMER0_A0_ISR is sending
+volatile signed char cTxLeft;	// Bytes of the frame not loaded into TXByte yet, -1 while the last stop bit completes
+volatile bool bTxDone;			// The whole frame is on the bus
+unsigned int uiBitTime = Bit_time;			// Bus bit time for the selected rate
+// Bus receiver: TIMER0_A0_ISR samples every bit (start and stop bit included) RX_SAMPLES times around its centre, uiRxGap apart,
+// and the majority decides. Rates that leave less than RX_MIN_GAP between the samples take one sample per bit
+#define		RX_SAMPLES	3				// Odd
+#define		RX_MIN_GAP	128				// SMCLK cycles, room for the other ISRs between two samples
+#define		RX_NOISE	0x01			// The samples of a bit disagreed, the vote decided it
+#define		RX_FRAMING	0x02			// The stop bit was not a mark
+unsigned char ucRxSamples = RX_SAMPLES;		// Samples per bit at the selected rate
+unsigned int uiRxGap;						// Cycles between the samples of a bit
+unsigned int uiRxFirst;						// Cycles from the start bit edge to its first sample
+unsigned int uiRxNext;						// Cycles from the last sample of a bit to the first one of the next
+unsigned char ucRxPhase;					// Samples of the current bit still to take
+unsigned char ucRxVotes;					// Mark samples of the current bit
+unsigned char ucRxFlags;					// RX_NOISE and RX_FRAMING of the byte being received
+
+#define		CMD_SLOTS	2			// Commands that can be queued by the controller, one arriving while all are full is dropped
+#define		CMD_LEN		30			// Longest command including the CR
+#define		CMD_DROPPING	-2		// cRx while the bytes of a dropped command are skipped up to its CR
+char CmdQueue[CMD_SLOTS][CMD_LEN + 1];	// Commands received by USCI0RX_ISR while main() works on an earlier one
+volatile unsigned char CmdDropped[CMD_SLOTS];	// Commands dropped after the one in each slot, main() replies ~BUSY for them after its reply
+volatile signed char cRx = -1;		// Index for the CmdQueue slot being received
+volatile unsigned char ucRxSlot = 0;	// CmdQueue slot being received
+volatile unsigned char ucCmdReady = 0;	// Complete commands waiting in CmdQueue
+unsigned char ucCmdSlot = 0;		// Oldest complete command
+unsigned long CmdStamp[CMD_SLOTS];	// GetTicks() when the CR of each queued command arrived
+char *CmdBuf = CmdQueue[0];			// Command being executed and its parameters
 signed char cCmd = -1;	  		// Index for CmdBuf
-char SendBuf[]="                                        ";    // Buffer for communications
+#define		SEND_LEN	40				// Longest reply including the CR
+char SendBuf[SEND_LEN + 1];		// Buffer for communications
 signed char cSend = -1;			// Index for SendBuf[]
 
-bool ADCDone;					// ADC Done flag
-unsigned int ADCValue;			// Measured ADC Value
-
-char *Flash_ptrA = (char *) 0x10C0;                         // Segment A pointer
-char *Flash_ptrB = (char *) 0x1080;                         // Segment B pointer
-char *Flash_ptrC = (char *) 0x1040;                         // Segment C pointer
-char *Flash_ptrD = (char *) 0x1000;                         // Segment D pointer
+#define		TX_RING_SIZE	8		// Controller reply ring buffer, must be a power of two (UartPut() sleeps while it is full)
+char TxRing[TX_RING_SIZE];		// Bytes waiting to be sent to the controller by USCI0TX_ISR
+volatile unsigned char ucTxHead = 0;	// Next free slot (written by main)
+volatile unsigned char ucTxTail = 0;	// Next byte to send (written by USCI0TX_ISR)
+
+bool bCutThrough = false;		// Forward non-redundant serf replies byte by byte as they arrive
+// Streaming validation of serf replies by ReceiveByte()
+signed char cRecv;				// Position of the last received byte in the reply as sent by the serf
+signed char cMiddle;			// Position of the separating SC of a redundant reply, -1 until it arrives
+bool bRedundant;				// The reply started with an SC, its data is sent twice
+bool bFramingError;				// SC or CR in the wrong place
+bool bCompareError;				// Second copy of the data did not match the first
+unsigned int uiFramesOK = 0;	// Validator statistics, read with ~VS
+unsigned int uiFramingErrors = 0;
+unsigned int uiCompareErrors = 0;
+unsigned int uiTimeouts = 0;
+unsigned int uiCrcErrors = 0;
+unsigned int uiNoiseBytes = 0;	// Bytes with a bit decided by the majority of its samples
+
+// CRC-16 framed serfs send <Address><data><CRC as 4 hex digits>CR instead of redundant data
+// CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) over the address and data
+#define		ADDR_FIRST	0x20			// Serf addresses covered by the per-address tables
+#define		ADDR_LAST	0x7F
+const unsigned int CrcTable[16] = {0x0000,0x1021,0x2042,0x3063,0x4084,0x50A5,0x60C6,0x70E7,
+									0x8108,0x9129,0xA14A,0xB16B,0xC18C,0xD1AD,0xE1CE,0xF1EF};
+bool bCrcFrame;					// The serf being polled uses CRC-16 framing
+unsigned int uiCrc;				// CRC of the reply received so far (lags four bytes behind)
+
+bool bStreamReply;				// Cut-through is allowed for the current transaction
+bool bStreaming;				// The serf reply being received is being forwarded by the receive ISR
+signed char cStreamed = -1;		// Index of the last SendBuf[] byte already queued for the controller
 
-unsigned long *FlashReadDelay = (unsigned long *) 0x1000;
-unsigned long LastReadDelay;
+bool ADCDone;					// ADC Done flag
+#define		ADC_BLOCK	16			// Samples per DTC block
+#define		ADC_SETTLE	4095		// Cycles for the sensor supply (P1.7) and the reference to settle
+#define		ADC_SCAN_MAX	7		// Channels in one ~AS scan (V, T, 3, 4, 5, 6, 7)
+unsigned int ADCBlock[ADC_BLOCK];	// DTC destination
+unsigned char ucOversample = 0;	// Samples per AD measurement: 0 = 16, 1 = 64, 2 = 256
+bool bDecimate = false;			// Return the oversampled sum with 2, 3 or 4 extra bits instead of the 10 bit average
+
+// Continuous AD streaming (~AC): Timer0_A CCR2 (OUT2) triggers the ADC, the DTC fills the two halves of ADCBlock[] in turn
+// and main() sends each completed half as a binary frame:
+//	ADC_STREAM_SYNC, <sequence>, <blocks dropped since the last frame>, <sample count>, <samples, 16 bit little endian>, <sum of the previous bytes>
+#define		ADC_STREAM_BLOCK	(ADC_BLOCK / 2)
+#define		ADC_STREAM_SYNC		0xA5
+#define		ADC_STREAM_MAX_RATE	8000	// Samples per second
+bool bAdcStreaming = false;
+volatile unsigned char ucAdcReady = 0;	// Stream halves filled and not sent yet, bit 0 = first half, bit 1 = second half
+volatile unsigned char ucAdcDropped = 0;	// Halves overwritten before main() could send them
+unsigned char ucAdcSeq = 0;				// Frame sequence number
+unsigned char ucAdcChunks;				// CCR2 compares per sample period (periods over 0xFFFF ticks are split)
+unsigned int uiAdcChunk;				// Ticks per compare
+unsigned int uiAdcChunkExtra;			// Remainder added to the first compare of a period
+volatile unsigned char ucAdcChunkLeft;	// Compares left until OUT2 rises and triggers the next sample
+
+// Binary controller protocol (~BM:1), ASCII after reset
+// Every reply becomes one frame: BIN_SYNC, <payload length>, <payload>, <sum of the previous bytes>
+// The payload is the ASCII reply without its CR (and LF), with the values of TransmitValue() and TransmitLongValue()
+// as 16 and 32 bit little endian numbers and no separators between them
+#define		BIN_SYNC		0x5A
+bool bBinary = false;
+bool bBinaryRequest = false;	// Mode for the replies after the current one
+
+// Settings kept in the configuration store (see CfgIndex[]), they read as erased flash until they are written
+#define		FlashReadDelay		((uint32_t *) CfgValue(CFG_READ_DELAY))	// Serf response timeout in microseconds
+#define		FlashBaudRates		CfgValue(CFG_BAUD_RATES)	// Confirmed rates, low nibble controller index, high nibble bus index
+#define		FlashCrcMap			CfgValue(CFG_CRC_MAP)		// 12 bytes, one bit per address from ADDR_FIRST, cleared = CRC-16 framing
+unsigned long LastReadDelay;	// Microseconds from the end of the last forwarded command to the CR of its reply
 unsigned long MaxDelay = 0;
+unsigned long LastReplyLatency;	// Microseconds from the CR of the last master command to its reply being queued, read with ~WL
+unsigned long MaxReplyLatency = 0;
+
+// main() sleeps in LPM0 until an ISR posts one of these events and wakes it, LPM3 is not an option because
+// the controller UART, the bus timing and the time base all run from SMCLK
+#define		EV_COMMAND		0x01		// USCI0RX_ISR: a command is complete
+#define		EV_TICK			0x02		// TIMER1_A1_ISR: uiTimerHigh has advanced, a deadline or schedule entry may be due
+#define		EV_ADC			0x04		// ADC10_ISR: a stream half is ready
+#define		EV_UART			0x08		// USCI0RX_ISR: UART_ERROR_LIMIT framing errors on the controller link
+volatile unsigned char ucEvents = EV_TICK;	// Posted by the ISRs, main() posts again what it could not finish in one pass
+
+volatile unsigned int uiTimerHigh = 0;		// Timer1_A overflow count, upper word of GetTicks()
+volatile unsigned int uiTimeoutWraps;		// Full Timer1_A periods left before the CCR1 match is the timeout
+volatile bool bTimeout;						// StartTimeout() interval has elapsed
+volatile bool bReplyDone;					// CR of the serf reply has been received
+
+unsigned char ucBaudActive;			// Rates in use, same format as *FlashBaudRates
+unsigned char ucBaudPrevious;		// Rates to return to if a new setting is not confirmed
+unsigned char ucBaudRequest;		// Rates requested by ~BR:, applied once the reply has been sent
+bool bBaudRequest = false;
+bool bBaudTrial = false;			// New rates are in use but not confirmed by the controller yet
+unsigned int uiBaudDeadline;		// uiTimerHigh value at which an unconfirmed setting is reverted
+#define		BUS_TRIAL_MISSES	4		// Failed serf transactions in a row that return an unproven bus rate to 9600
+bool bBusTrial = false;				// The bus rate in use is confirmed but no serf has answered at it yet
+bool bBusProven = false;			// A serf has answered at the trial rate, main() stores it
+unsigned char ucBusMisses;			// Failed transactions in a row during the bus trial
+volatile unsigned char ucUartErrors = 0;	// Controller framing errors since the last complete command
+
+// Background polling schedule, configured with ~SE: and kept in the configuration store
+#define		SCHED_SLOTS		4
+#define		SCHED_CMD_LEN	7			// Serf command including its CR
+#define		SCHED_REPLY_LEN	8			// Cached reply length (address and data, without the CR), longer replies are cut
+#define		SCHED_MAX_PERIOD	10737	// 0.1s units, 32766 ticks: a due time must stay within half a wrap of uiTimerHigh (~17.9 minutes)
+typedef struct {
+	char Addr;							// Serf address, 0xFF = slot unused
+	char Cmd[SCHED_CMD_LEN];			// Serf command up to and including its CR
+	uint16_t Period;					// Poll period in 0.1s
+} ScheduleEntry;
+#define		FlashSchedule(n)	((ScheduleEntry *) CfgValue(CFG_SCHEDULE + (n)))
+char SchedReply[SCHED_SLOTS][SCHED_REPLY_LEN];	// Latest validated reply of each entry, 0 after a shorter one, empty = nothing cached yet
+unsigned int SchedStamp[SCHED_SLOTS];	// uiTimerHigh when SchedReply[] was stored
+#define		SCHED_MAX_AGE	0x7FFF		// Ticks, ~SR: shows at most 10737 (0.1s units, ~17.9 minutes)
+unsigned int SchedDue[SCHED_SLOTS];		// uiTimerHigh when the entry is polled next
+unsigned char ucSchedNext = 0;			// Entry checked first on the next RunSchedule()
+
+// Per serf statistics, read with ~SH: and ~SN:, cleared with ~SX
+// A serf that answers takes a free slot and keeps it until ~SX frees it, later serfs are not tracked once all are taken.
+// ~ST: takes a slot for an address ahead of time, so the serfs that matter can be chosen before the others answer.
+// Hist[] bins the reply delays by powers of two of STATS_UNIT_SHIFT microseconds: bin 0 < 2ms, bin 1 < 4ms ... bin 6 < 131ms, bin 7 the rest
+#define		STATS_SLOTS			4		// Serfs tracked (also by the adaptive timeout)
+#define		STATS_BINS			8
+#define		STATS_UNIT_SHIFT	11		// 2048us
+typedef struct {
+	unsigned int Bytes;					// Reply bytes received (both copies of redundant data)
+	char Addr;							// Serf address, 0 = slot unused
+	unsigned char Timeouts;				// Saturate at 255
+	unsigned char Errors;				// Framing, compare and CRC errors, saturate at 255
+	unsigned char Hist[STATS_BINS];		// All bins are halved when one of them would overflow
+	unsigned char Probe;				// Timed out under a learned timeout, wait the full Read Delay next time
+} SerfStats;
+SerfStats Stats[STATS_SLOTS];
+
+// Adaptive response timeout (~AE:1): twice the upper edge of the Hist[] bin holding the ADAPT_PERCENTILE of the replies,
+// kept between the floor (~AF:) and the Read Delay. Bin STATS_BINS-1 and serfs with too few replies use the Read Delay.
+// ~AP stores the learned bins and the enable, they are used until a serf has enough replies again
+#define		ADAPT_MIN_REPLIES	16
+#define		ADAPT_PERCENTILE_SHIFT	4		// Ignore the slowest 1/16 of the replies (94th percentile)
+#define		ADAPT_FLOOR_DEFAULT	10000		// Microseconds, used while *FlashAdaptFloor is erased
+#define		ADAPT_NONE			0xFF		// No learned bin
+#define		FlashAdaptFloor		((uint32_t *) CfgValue(CFG_ADAPT_FLOOR))	// Shortest adaptive timeout in microseconds
+#define		FlashAdapt			CfgValue(CFG_ADAPT)		// <1 = enabled>, then STATS_SLOTS pairs of <serf address><bin>
+bool bAdaptive;
+
+// Discovery (~DS:): serfs that did not answer the FV probe get NOSERF replies without using the bus
+// The absent ones are probed again in the background, one every DISC_REPROBE_TICKS while the bus is idle
+#define		DISC_REPROBE_TICKS	305		// Timer1_A overflows, ~10s
+const char DiscProbe[] = "FV\r";
+unsigned char AbsentMap[(ADDR_LAST - ADDR_FIRST + 8) / 8];	// One bit per address from ADDR_FIRST, set = probed and absent
+unsigned char ucReprobeNext = 0;		// Address (- ADDR_FIRST) to look at for the next background probe
+unsigned int uiReprobeDue = 0;			// uiTimerHigh of the next background probe
+
+// Retry policy (~RP:, ~RW:): serf commands that are safe to repeat are sent again after a timeout or a failed check,
+// FlashRetryGap milliseconds apart, and their reply ends with #<attempts>. FV and the RETRY_WHITELIST commands qualify
+#define		RETRY_MAX			9
+#define		RETRY_MAX_GAP		10000	// Milliseconds
+#define		RETRY_WHITELIST		4		// Two character serf commands
+#define		RETRY_SUFFIX_LEN	4		// '#', the attempts (two digits, or two bytes in binary mode) and the CR
+#define		FlashRetryCount		CfgValue(CFG_RETRY)		// Retries after the first attempt, erased = none
+#define		FlashRetryGap		((uint16_t *) (CfgValue(CFG_RETRY) + 2))	// Milliseconds between attempts, erased = none
+#define		FlashRetryWhitelist	CfgValue(CFG_RETRY_WHITELIST)	// RETRY_WHITELIST pairs of command characters, 0xFF = unused
+
+// Configuration store: a log of <key><length><data> records in the information segments D, C and B (A holds the calibration)
+// A segment in use starts with CFG_MAGIC and a sequence number. Records are appended to the newest segment, padded to whole
+// words, and the last record of a key is its value. A full segment is continued in an erased one, and when that leaves no
+// erased segment the live records of the oldest are copied forward and it is erased. A setting costs a few word programs
+// instead of a segment erase. CfgIndex[] locates the data of the live records, built once by ConfigInit()
+// Multi-byte values in the store use uint16_t and uint32_t, a host build (SAMEWIRE_HOST) lays them out the same way
+#define		CFG_SEGMENTS		3
+#define		CFG_SEG_SIZE		64
+#define		CFG_MAGIC			0xC7
+#define		CFG_READ_DELAY		0		// uint32_t
+#define		CFG_BAUD_RATES		1		// char
+#define		CFG_CRC_MAP			2		// 12 bytes
+#define		CFG_ADAPT_FLOOR		3		// uint32_t
+#define		CFG_RETRY			4		// <retries><0xFF><gap, uint16_t>
+#define		CFG_RETRY_WHITELIST	5		// 2 * RETRY_WHITELIST bytes
+#define		CFG_ADAPT			6		// 1 + 2 * STATS_SLOTS bytes
+#define		CFG_SCHEDULE		7		// ScheduleEntry, one key per slot
+#define		CFG_KEYS			(CFG_SCHEDULE + SCHED_SLOTS)
+#define		CfgSegment(k)		(INFO_FLASH_BASE + ((k) << 6))	// 0 = D, 1 = C, 2 = B
+const uint16_t CfgErased[8] = {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF};	// Value of the keys not written yet
+#define		CFG_UNSET			0xFF	// CfgIndex[] of a key without a record
+unsigned char CfgIndex[CFG_KEYS];		// Offset from INFO_FLASH_BASE of the data of the live record of each key
+#define		CfgValue(k)			(CfgIndex[k] == CFG_UNSET ? (char *)CfgErased : INFO_FLASH_BASE + CfgIndex[k])
+unsigned char ucCfgHead;				// Segment receiving new records
+unsigned char ucCfgFree;				// Offset of the first erased byte in the head segment
+
+// Serf reset (~RS[:ms]): the bus is held low until uiResetDeadline, main() then releases it and sends ~DONE
+#define		RESET_DEFAULT_MS	5000
+#define		RESET_MAX_MS		60000
+bool bResetting = false;
+unsigned int uiResetDeadline;			// uiTimerHigh at which the bus is released
+
+// Master commands: ~<two letters>[:<parameters>]CR, found in CmdTable[] by a hash of the letters instead of comparing them in turn
+// Each entry declares how many parameter characters it takes, ExecuteCommand() replies NO to parameters outside the schema before
+// the handler runs. The longest reply a handler builds in SendBuf (after the ID, without the CR) is only checked by the build
+#define		CMD_TABLE		64			// Power of two, CMD_HASH() must give every command a slot of its own (see CmdHashCheck())
+#define		CMD_HASH(a, b)	(((((a) << 3) + (a)) ^ (b) ^ ((b) >> 4)) & (CMD_TABLE - 1))
+#define		CMD_BARE		-1			// Args of a command without ':'
+#define		CMD_ADC			0x01		// Needs the ADC, BUSY while ~AC is streaming
+#define		CMD_BUS			0x02		// Needs the bus, BUSY while ~RS holds it low
+#define		CMD_ADDR		0x04		// The first parameter, if there is one, is a serf address (ADDR_FIRST - ADDR_LAST)
+#define		CMD(a, b, Handler, Flags, ArgMin, ArgMax, MaxReply) \
+	[CMD_HASH(a, b)] = {{a, b}, Flags, ArgMin, ArgMax, Handler},
+typedef struct {
+	char Name[2];
+	unsigned char Flags;
+	signed char ArgMin;					// Parameter characters after the ':', CMD_BARE allows the form without ':'
+	signed char ArgMax;
+	bool (*Handler)(signed char Args);	// false = parameters rejected
+} MasterCommand;
+#define		DELAY_MAX_US	999999		// Longest ~RD: and ~AF: setting, the largest value TransmitLongValue() shows in ASCII
 
 // Function Definitions
-void Transmit(void);
+void Transmit(char *Frame, unsigned char Length);
 void TransmitDecimal(unsigned int);
 void TransmitExtendedDecimal(unsigned char, unsigned int, char);
+void TransmitValue(unsigned int Value);
+void TransmitLongValue(unsigned long Value);
+void TransmitSeparator(char c);
 void ExecuteCommand(void);
 void Single_Measure(unsigned int, unsigned char);
 void Average_Measure(unsigned int, unsigned char);
-bool ProgramFlashInfoSegment(char *ptrDestSeg,char *ptrDestAddr,char *ptrSource,char NumItems);
-unsigned long ConvertAdvCmdParameterFloatToHex(char CmdBufOffset, char MultipleOfTen);
+void Scan_Measure(char *Channels, unsigned char Count, unsigned char Reference);
+void ADCStart(unsigned int Ctl1, unsigned char Reference, unsigned char Transfers);
+void ADCConvertBlock(void);
+void TransmitADCResult(unsigned long ADCSum);
+unsigned int ADCSamples(void);
+void StartADCStream(unsigned int chan, unsigned char Reference, unsigned long Period);
+void StopADCStream(void);
+void SendADCBlock(void);
+void ConfigInit(void);
+void ConfigMigrate(void);
+bool ConfigWrite(unsigned char Key, const char *Data, unsigned char Len);
+signed char CfgScan(unsigned char Seg, bool bIndex);
+bool CfgAppend(unsigned char Key, const char *Data, unsigned char Len);
+void CfgOpen(unsigned char Seg, unsigned char Seq);
+void CfgRoll(void);
+bool CfgCompact(void);
+void FlashErase(char *Segment);
+bool FlashWrite(char *Dest, const char *Source, unsigned char Length);
+signed char ParseNumber(unsigned char i, unsigned char Decimals, unsigned long Max, unsigned long *Value);
 void SendOKNO(bool PF);
+void SendText(const char *Text);
+void UartPut(char c);
+bool UartTryPut(char c);
+void StreamToController(void);
+void SendToController(void);
+unsigned long GetTicks(void);
+void StartTimeout(unsigned long us);
+void StopTimeout(void);
+void SetBaudRates(unsigned char Rates);
+void BaudStore(unsigned char Mask);
+void BusTrial(unsigned char Result);
+unsigned char BusTransaction(char Addr, const char *Cmd, bool bForward);
+bool ReceiveByte(char c, unsigned char Flags);
+unsigned int CrcUpdate(unsigned int Crc, char c);
+bool CrcAddress(char Addr);
+char HexChar(unsigned char Nibble);
+bool RunSchedule(void);
+bool SerfAbsent(char Addr);
+bool DiscoverSerf(char Addr);
+void RunReprobe(void);
+bool RetryAllowed(char *Cmd);
+unsigned char RetryTransaction(char Addr, char *Cmd);
+void Pause(unsigned long us);
+unsigned int TicksToTenths(unsigned int Ticks);
+SerfStats *StatsFind(char Addr);
+SerfStats *StatsTrack(char Addr);
+void StatsRecord(char Addr, unsigned char Result);
+unsigned char AdaptBin(char Addr);
+unsigned long ResponseTimeout(char Addr);
 
 void main(void)
 {
-	unsigned long ulCycles;
-	signed int i;
 
 	WDTCTL = WDTPW + WDTHOLD;	// Stop WDT
 
 	BCSCTL1 = CALBC1_16MHZ;		// Set range
 	DCOCTL = CALDCO_16MHZ;		// SMCLK = DCO = 16MHz
+	ConfigInit();				// Settings from the information flash
 	// Initialize USCI UART
     UCA0CTL1 |= UCSWRST;				// Disable USCI
     UCA0CTL1 = UCSSEL_2 + UCSWRST;		//SMCLK
     //http://www.daycounter.com/Calculators/MSP430-Uart-Calculator.phtml
-    //http://e2e.ti.com/support/microcontrollers/msp430/f/166/t/18687.aspx
-    // 9600 baud settings for 16Mhz
-    UCA0MCTL = UCBRS_6;
-    UCA0BR0 = 82;
-    UCA0BR1 = 6;
     //9600 baud settings for 1Mhz
 //    UCA0MCTL = UCBRF_0 + UCBRS_1;
 //	UCA0BR0 = 104;
 //	UCA0BR1 = 0;
+    // Controller and bus rates confirmed by ~BR:, erased flash selects 9600 for both
+    SetBaudRates(*FlashBaudRates);
+    ucBaudPrevious = ucBaudActive;
+    bAdaptive = (FlashAdapt[0] == 1);
 
-    UCA0CTL1 &= ~UCSWRST;
     IFG2 &= ~(UCA0RXIFG);
     IE2 |= UCA0RXIE;
     // Select Secondary Peripheral Module for USCI P1.1 RX and P1.2 TX
@@ -128,26 +420,26 @@ void main(void)
 
     ADC10AE0 |= (BIT3 + BIT4 + BIT7);
 
-	P1IES &= ~RXD;				// RXD Lo/Hi edge interrupt, INVERT to handle serf inverted drive
-	P1IFG &= ~RXD;				// Clear RXD (flag)
-	P1IE &= ~RXD;				// Disable RXD interrupt
-// Disable interrupt on all Port1 pins except P1.6
-	P1IE &= ~(BIT0 + BIT1 + BIT2 + BIT3 + BIT4 + BIT5 + BIT7);
+	CAPD |= CAPD6;				// RXD only goes to the comparator, no digital input buffer
+	CACTL2 = P2CA3 + P2CA2 + CAF;	// CA6 (RXD) to the - input, filtered output
+	CACTL1 = CAREF_2;			// 0.5Vcc to the + input: CAOUT high = RXD low = mark, this undoes the serf inverted drive (CAON while receiving)
+	P1IE = 0;					// No Port1 pin interrupts, start bits are captured by Timer0_A CCR1
+
+	// Timer1_A is the free running time base for delay measurement and the serf response timeout (CCR1)
+	TA1CTL = TASSEL_2 + ID_3 + MC_2 + TACLR + TAIE;	// SMCLK/8, continuous mode, overflow interrupt
 
 	bRXBit = false; 			// Set initial values
-	bRXByte = false;
 	cSend = -1;
 
-	// If the FlashReadDelay is default, then initialize to a smaller value
+	// If the FlashReadDelay is default (erased, or dropped by ConfigMigrate()), then initialize to a smaller value
 	if (*FlashReadDelay == 0xFFFFFFFF){
-		unsigned long l = 1000; // initialize to this value
+		unsigned long l = 100000; // initialize to this value (100ms)
 		char a[4];
 		a[3] = l>>24;
 		a[2] = l>>16;
 		a[1] = l>>8;
 		a[0] = l;
-		void *ptr = FlashReadDelay;
-		ProgramFlashInfoSegment(Flash_ptrD,ptr,a,4);
+		ConfigWrite(CFG_READ_DELAY,a,4);
 	}
 	// For Debugging
 //	P2DIR |= BIT0 + BIT1 + BIT2 + BIT3;
@@ -156,248 +448,1281 @@ void main(void)
 	__bis_SR_register(GIE); 	// interrupts enabled
 
 	while(1){
-		//Check for a Carriage Return and run command if found
-		if (CmdBuf[cCmd] == 0x0D){
-			IE2 &= ~UCA0RXIE;
+		unsigned char ev;
+		unsigned char k;
+		HAL_IDLE();
+		__disable_interrupt();
+		while (!ucEvents){			// Nothing to do, sleep until an ISR posts an event
+			__bis_SR_register(LPM0_bits + GIE);
+			__disable_interrupt();
+		}
+		ev = ucEvents;
+		ucEvents = 0;
+		__enable_interrupt();
+		if ((ev & EV_ADC) && ucAdcReady){	// Nothing is ready if the stream was stopped after the event was posted
+			SendADCBlock();		// AD stream data goes out between commands
+			if (ucAdcReady)
+				ucEvents |= EV_ADC;	// The other half is ready too
+		}
+		if (ev & EV_TICK){
+			// Return to the previous rates if the controller did not confirm a new setting in time
+			if (bBaudTrial && (signed int)(uiTimerHigh - uiBaudDeadline) >= 0){
+				bBaudTrial = false;
+				SetBaudRates(ucBaudPrevious);
+			}
+			// A trial bus rate has carried a valid reply, stored here rather than deep in BusTransaction()
+			if (bBusProven){
+				bBusProven = false;
+				BaudStore(0xF0);
+			}
+			// Cached schedule replies stop ageing at SCHED_MAX_AGE, before the difference to uiTimerHigh wraps
+			for (k=0;k<SCHED_SLOTS;k++)
+				if ((unsigned int)(uiTimerHigh - SchedStamp[k]) > SCHED_MAX_AGE)
+					SchedStamp[k] = uiTimerHigh - SCHED_MAX_AGE;
+			// End of a serf reset
+			if (bResetting && (signed int)(uiTimerHigh - uiResetDeadline) >= 0){
+				P1OUT &= ~TXD;				// Set TX Pin low to allow bus to go high
+				P1OUT |= BIT0; 		// Enable high current drive
+				bResetting = false;
+				cSend = -1;
+				SendBuf[++cSend] = ID;
+				SendText("DONE");
+				if (!bBinary)
+					SendBuf[++cSend] = 0x0D;
+				SendToController();
+			}
+		}
+		// Fall back to 9600 on the controller link when only garbage is arriving
+		if ((ev & EV_UART) && ucUartErrors >= UART_ERROR_LIMIT){
+			ucUartErrors = 0;
+			if (ucBaudActive & 0x0F)
+				SetBaudRates(ucBaudActive & 0xF0);
+		}
+		//Run the oldest complete command, the controller can queue the next one meanwhile
+		if ((ev & EV_COMMAND) && ucCmdReady){
+			CmdBuf = CmdQueue[ucCmdSlot];
+			cCmd = (char *)memchr(CmdBuf, 0x0D, CMD_LEN) - CmdBuf;	// USCI0RX_ISR only hands over a slot with its CR
+			ucUartErrors = 0;
 			if(CmdBuf[0] == ID){	//Command string must be a specific length (ID-1)(Cmd-2)(:)(Parameters-1or2)(CR-1); remember the first character is cCmd=0
-				if(cCmd == 3 || (cCmd > 3 && CmdBuf[3] == ':'))
+				if (bBaudTrial){	// A master command at the new rates confirms them
+					bBaudTrial = false;
+					bBusTrial = (ucBaudActive & 0xF0) && ((*FlashBaudRates ^ ucBaudActive) & 0xF0);	// 9600 needs no trial
+					ucBusMisses = 0;
+					BaudStore(bBusTrial ? 0x0F : 0xFF);	// A new bus rate once a serf has answered at it (BusTrial())
+				}
+				if(cCmd == 3 || (cCmd > 3 && CmdBuf[3] == ':')){
 					ExecuteCommand();
+					LastReplyLatency = (GetTicks() - CmdStamp[ucCmdSlot]) / TICKS_PER_US;
+					if (LastReplyLatency > DELAY_MAX_US)	// Retried transactions can take seconds, ~WL shows 6 digits
+						LastReplyLatency = DELAY_MAX_US;
+					if (LastReplyLatency > MaxReplyLatency)
+						MaxReplyLatency = LastReplyLatency;
+				}
 				cCmd=-1;							//Reset Receive byte counter
+				if (bBaudRequest){	// Switch only after the OK has gone out at the old rates
+					bBaudRequest = false;
+					ucBaudPrevious = ucBaudActive;
+					SetBaudRates(ucBaudRequest);
+					uiBaudDeadline = uiTimerHigh + BAUD_CONFIRM_TICKS;
+					bBaudTrial = true;
+				}
 			}else{									//Wait for a Carriage Return before retransmitting
-//				P2OUT |= BIT3;//debug
-				P1OUT &= ~BIT0; 		// Disable high current drive
-				P1IE &= ~RXD;			// Disable RXD interrupt
-				P1IFG &= ~RXD;				// Clear RXD (flag)
-				//For Power Line
-//				P1OUT &= ~TXD;				// Turn off TXD pin
-				CCTL0 &= ~CCIE ;			// Disable interrupt
-				CCTL0 &= ~CCIS0;
-				CCTL0 &= ~OUT;				// Set TXD LOW (inverted)
-				CCTL0 &= ~(OUTMOD2 + OUTMOD1 + OUTMOD0);			// Set TXD to output only mode
-				P1SEL |= TXD;				// Connect TXD to timer pin (was being used to power the line)
-
-//				__delay_cycles (300);		// Delay for Transmitter to turn on and Receiver to turn off
-
-				i = 0;
-				while (i<=cCmd){
-					TXByte = CmdBuf[i++];
-					Transmit();
+				if (bResetting){				// The bus is held low
+					cSend = 0;
+					SendBuf[0] = CmdBuf[0];
+					SendText("BUSY");
+					SendBuf[++cSend] = 0x0D;
+				}else if (SerfAbsent(CmdBuf[0])){		// Fast fail, discovery found nothing at this address
+					cSend = 0;
+					SendBuf[0] = CmdBuf[0];
+					SendText("NOSERF");
+					SendBuf[++cSend] = 0x0D;
+				}else{
+					RetryTransaction(CmdBuf[0], &CmdBuf[1]);
 				}
 
-				//Turn off TXD pin
-//				CCTL0 &= ~(OUTMOD2 + OUTMOD1 + OUTMOD0 + OUT);
-				CCTL0 &= ~CCIS0;			// debug code, this can be removed if it can be verified that it is not needed.  Somehow the CCIS0 bit was getting set
-				P1OUT &= ~TXD;				// allow line to go high
-				P1SEL &= ~TXD;				// Connect TXD to IO
-				RXByte = 0;
-				bRXByte = false;
-				TACTL = TASSEL_2 + MC_2;	// SMCLK, continuous mode
-				P1IES &= ~RXD;				// RXD Lo/Hi edge interrupt, INVERT to handle serf inverted drive
-				P1IFG &= ~RXD;				// Clear RXD (flag) before enabling interrupt
-				ulCycles = 0;
-				// Wait so we don't interpret our TX signal dropping as the Start bit from the remote transmitter
-				__delay_cycles (280);	// Delay for Transmitter to turn off and Receiver to turn on
-				P1IE |= RXD;				// Enable RXD interrupt
-
-				//Wait for response
-				unsigned long ulShortWaitCycles;
-				char LastSendIndex = 0;
-				while (ulCycles < *FlashReadDelay){
-					ulCycles++;
-					if (SendBuf[cSend] == 0x0D && !bStopbit){
-						LastReadDelay = ulCycles;
-						if (ulCycles > MaxDelay)
-							MaxDelay = ulCycles;
-						ulCycles = *FlashReadDelay;
-					}
-					if (cSend > LastSendIndex){// when a character arrives, expect the remaining characters to follow quickly, otherwise stop waiting
-						LastSendIndex = cSend;
-						ulShortWaitCycles = Bit_time<<5;// * 10 * 3;
-					}
-					ulShortWaitCycles--;
-					if (ulShortWaitCycles == 0)
-						ulCycles = *FlashReadDelay;
-				}
-				TACTL = TASSEL_2;		// SMCLK, timer off (for power consumption)
-				bRXBit = false;
-				P1IE &= ~RXD;			// Disable RXD interrupt
-
-				//If a serf has redundant data turned on, filter it before sending to the controller
-				//redundant data is the data sent two times, bounded by character 255 (inside the Address and CR characters) and separated by character 255
-				//if only one 255 character is found, send an error to the controller
-				bool bFSC = false; // Found special character
-				char SC = 31; // Special Character
-				if(cSend > -1){
-					for(i=0;i<=cSend;i++){
-						if (SendBuf[i] == SC)
-							bFSC = true;
-					}
-				}
-				bool bERROR = false;
-				if (bFSC){
-					// check for special character at beginning, end and middle
-					char middle = cSend>>1;
-					if(SendBuf[1] != SC || SendBuf[cSend-1] != SC || SendBuf[middle] != SC)
-						bERROR = true;
-					for(i=1;i<middle;i++){
-						if (SendBuf[i+1] == SendBuf[i+middle]){
-							SendBuf[i] = SendBuf[middle+i];
-						}else{
-							bERROR = true;
-						}
-					}
-					SendBuf[middle-1] = 0x0D;
-					cSend = middle-1;
-					if(bERROR){
-						SendBuf[1] = 'E';
-						SendBuf[2] = 'R';
-						SendBuf[3] = 'R';
-						SendBuf[4] = 'O';
-						SendBuf[5] = 'R';
-						SendBuf[6] = 0x0D;
-						cSend = 6;
-					}
+				// Send to Controller (drained in the background by USCI0TX_ISR), skipping what cut-through already sent
+				if (bBinary){
+					if (cSend >= 0 && SendBuf[cSend] == 0x0D)
+						cSend--;		// The frame length replaces the CR
+					SendToController();
+				}else{
+					SendToController();
+					UartPut(0x0A);  //send new line
 				}
+				cCmd=-1;
+			}
+			// Commands that arrived while the queue was full behind this one, answered in the order they came
+			__disable_interrupt();
+			k = CmdDropped[ucCmdSlot];
+			CmdDropped[ucCmdSlot] = 0;
+			__enable_interrupt();
+			while (k--){
+				SendBuf[++cSend] = ID;
+				SendText("BUSY");
+				if (!bBinary)
+					SendBuf[++cSend] = 0x0D;
+				SendToController();
+			}
+			// Free the slot
+			if (++ucCmdSlot == CMD_SLOTS)
+				ucCmdSlot = 0;
+			__disable_interrupt();
+			if (--ucCmdReady)
+				ucEvents |= EV_COMMAND;		// The next one is queued already
+			__enable_interrupt();
+		}else if ((ev & EV_TICK) && !bResetting){	// Bus is free, poll the next scheduled entry that is due
+			if (RunSchedule())
+				ucEvents |= EV_TICK;		// Another one may be due as well
+			else
+				RunReprobe();				// or look for a serf that was absent
+		}
+	}
+}
+
+bool RunSchedule(void)
+{	// Poll at most one due schedule entry and cache its reply if it passed the redundancy check
+	// Returns true if the bus was used
+	unsigned char k;
+	unsigned char n;
+	ScheduleEntry *e;
+	for (n=0;n<SCHED_SLOTS;n++){
+		k = ucSchedNext;
+		if (++ucSchedNext == SCHED_SLOTS)
+			ucSchedNext = 0;
+		e = FlashSchedule(k);
+		if (e->Addr == (char)0xFF || e->Period == 0 || e->Period > SCHED_MAX_PERIOD)
+			continue;
+		if ((signed int)(uiTimerHigh - SchedDue[k]) < 0)
+			continue;
+		SchedDue[k] = uiTimerHigh + (unsigned int)(((unsigned long)e->Period * 100000) >> 15);	// 0.1s to 32.768ms ticks
+		if (BusTransaction(e->Addr, e->Cmd, false) == BUS_OK){
+			for (n=0;n<SCHED_REPLY_LEN;n++)	// Without the CR
+				SchedReply[k][n] = n < cSend ? SendBuf[n] : 0;
+			SchedStamp[k] = uiTimerHigh;
+		}
+		cSend = -1;
+		return true;
+	}
+	return false;
+}
+
+bool SerfAbsent(char Addr)
+{	// true if discovery found no serf at Addr
+	if (Addr < ADDR_FIRST || Addr > ADDR_LAST)
+		return false;
+	Addr -= ADDR_FIRST;
+	return (AbsentMap[Addr >> 3] & (1 << (Addr & 7))) != 0;
+}
+
+bool DiscoverSerf(char Addr)
+{	// Probe Addr and update AbsentMap, any answer counts even if it failed the redundancy check
+	unsigned char n = Addr - ADDR_FIRST;
+	bool bPresent;
+	bPresent = BusTransaction(Addr, DiscProbe, false) != BUS_TIMEOUT || cRecv >= 0;
+	cSend = -1;
+	if (bPresent)
+		AbsentMap[n >> 3] &= ~(1 << (n & 7));
+	else
+		AbsentMap[n >> 3] |= 1 << (n & 7);
+	return bPresent;
+}
+
+void RunReprobe(void)
+{	// Probe the next absent serf once DISC_REPROBE_TICKS have passed since the last background probe
+	unsigned char n;
+	if ((signed int)(uiTimerHigh - uiReprobeDue) < 0)
+		return;
+	uiReprobeDue = uiTimerHigh + DISC_REPROBE_TICKS;
+	for (n=0;n<=ADDR_LAST - ADDR_FIRST;n++){
+		if (++ucReprobeNext > ADDR_LAST - ADDR_FIRST)
+			ucReprobeNext = 0;
+		if (AbsentMap[ucReprobeNext >> 3] & (1 << (ucReprobeNext & 7))){
+			DiscoverSerf(ucReprobeNext + ADDR_FIRST);
+			return;
+		}
+	}
+}
+
+bool RetryAllowed(char *Cmd)
+{	// true if the serf command Cmd can be repeated without side effects
+	unsigned char k;
+	if ((unsigned char)*FlashRetryCount > RETRY_MAX || *FlashRetryCount == 0)
+		return false;
+	if (Cmd[0] == 'F' && Cmd[1] == 'V')
+		return true;
+	for (k=0;k<2*RETRY_WHITELIST;k+=2)
+		if (FlashRetryWhitelist[k] == Cmd[0] && FlashRetryWhitelist[k+1] == Cmd[1])
+			return true;
+	return false;
+}
+
+unsigned char RetryTransaction(char Addr, char *Cmd)
+{	// BusTransaction() with bForward, repeated by the retry policy as long as nothing has been forwarded yet
+	unsigned char Result;
+	unsigned char n = 1;
+	if (!RetryAllowed(Cmd))
+		return BusTransaction(Addr, Cmd, true);
+	while (1){
+		Result = BusTransaction(Addr, Cmd, true);
+		if (Result == BUS_OK || cStreamed >= 0 || n > (unsigned char)*FlashRetryCount)
+			break;
+		n++;
+		if (*FlashRetryGap <= RETRY_MAX_GAP)
+			Pause((unsigned long)*FlashRetryGap * 1000);
+	}
+	if (cStreamed < 0){			// Attempts before the CR, unless cut-through has already sent the reply
+		if (cSend >= 0 && SendBuf[cSend] == 0x0D)
+			cSend--;
+		if (cSend > SEND_LEN - 1 - RETRY_SUFFIX_LEN)
+			cSend = SEND_LEN - 1 - RETRY_SUFFIX_LEN;	// A long reply loses its tail rather than overrun SendBuf
+		SendBuf[++cSend] = '#';
+		TransmitValue(n);
+		SendBuf[++cSend] = 0x0D;
+	}
+	return Result;
+}
+
+void Pause(unsigned long us)
+{	// Sleep in LPM0 for 'us' microseconds
+	StartTimeout(us);
+	__disable_interrupt();
+	while (!bTimeout){
+		__bis_SR_register(LPM0_bits + GIE);
+		__disable_interrupt();
+	}
+	__enable_interrupt();
+	StopTimeout();
+}
+
+unsigned int TicksToTenths(unsigned int Ticks)
+{	// Convert a number of Timer1_A overflows (32.768ms) to 0.1s
+	return ((unsigned long)Ticks * 32768) / 100000;
+}
+
+unsigned char BusTransaction(char Addr, const char *Cmd, bool bForward)
+{	// Send Addr and Cmd (up to and including its CR) to the serfs and collect the reply in SendBuf[0..cSend]
+	// bForward allows cut-through forwarding of the reply to the controller while it arrives
+	// Returns BUS_OK, BUS_ERROR (redundant data did not match) or BUS_TIMEOUT (no CR received)
+	unsigned long ulStart;
+	unsigned long ulWait;
+	signed int i;
+	SerfStats *s;
+
+	// Build the frame in SendBuf, it is sent before the reply starts to overwrite it
+	cSend = -1;
+	SendBuf[++cSend] = Addr;
+	bCrcFrame = false;
+	if (Addr != 0x0D){
+		i = 0;
+		while (Cmd[i] != 0x0D && cSend < CMD_LEN - 2)
+			SendBuf[++cSend] = Cmd[i++];
+		bCrcFrame = CrcAddress(Addr);
+		if (bCrcFrame){			// Append the check value of the address and command
+			uiCrc = 0xFFFF;
+			for (i=0;i<=cSend;i++)
+				uiCrc = CrcUpdate(uiCrc, SendBuf[i]);
+			SendBuf[++cSend] = HexChar(uiCrc >> 12);
+			SendBuf[++cSend] = HexChar(uiCrc >> 8);
+			SendBuf[++cSend] = HexChar(uiCrc >> 4);
+			SendBuf[++cSend] = HexChar(uiCrc);
+		}
+		SendBuf[++cSend] = 0x0D;
+	}
+	uiCrc = 0xFFFF;
+
+//	P2OUT |= BIT3;//debug
+	P1OUT &= ~BIT0; 		// Disable high current drive
+	CCTL1 = 0;				// No start bit capture while sending
+	//For Power Line
+//	P1OUT &= ~TXD;				// Turn off TXD pin
+	CCTL0 &= ~CCIE ;			// Disable interrupt
+	CCTL0 &= ~CCIS0;
+	CCTL0 &= ~OUT;				// Set TXD LOW (inverted)
+	CCTL0 &= ~(OUTMOD2 + OUTMOD1 + OUTMOD0);			// Set TXD to output only mode
+	P1SEL |= TXD;				// Connect TXD to timer pin (was being used to power the line)
+
+//	__delay_cycles (300);		// Delay for Transmitter to turn on and Receiver to turn off
+
+	Transmit(SendBuf, cSend + 1);
+	__disable_interrupt();		// TIMER0_A0_ISR sends the frame and wakes us after its last stop bit
+	while (!bTxDone){
+		__bis_SR_register(LPM0_bits + GIE);
+		__disable_interrupt();
+	}
+	__enable_interrupt();
+	cSend = -1;
+
+	//Turn off TXD pin
+//	CCTL0 &= ~(OUTMOD2 + OUTMOD1 + OUTMOD0 + OUT);
+	CCTL0 &= ~CCIS0;			// debug code, this can be removed if it can be verified that it is not needed.  Somehow the CCIS0 bit was getting set
+	P1OUT &= ~TXD;				// allow line to go high
+	P1SEL &= ~TXD;				// Connect TXD to IO
+	RXByte = 0;
+	bStreamReply = bForward && bCutThrough && !bBinary;	// A binary frame needs its length before the first byte
+	bStreaming = false;
+	cStreamed = -1;
+	cRecv = -1;
+	cMiddle = -1;
+	bRedundant = false;
+	bFramingError = false;
+	bCompareError = false;
+	TACTL = TASSEL_2 + MC_2;	// SMCLK, continuous mode
+	CACTL1 |= CAON;				// Comparator on, it settles during the delay below
+	bReplyDone = false;
+	// Wait so we don't interpret our TX signal dropping as the Start bit from the remote transmitter
+	__delay_cycles (280);	// Delay for Transmitter to turn off and Receiver to turn on
+	ulStart = GetTicks();
+	ulWait = ResponseTimeout(Addr);
+	StartTimeout(ulWait);
+	CCTL1 = RX_CAPTURE + CCIE;	// Capture the first start bit
+
+	//Wait for response in LPM0, ReceiveByte() restarts the timeout with CharGap_us for every character
+	//and wakes us on the CR, TIMER1_A1_ISR wakes us when the timeout elapses
+	__disable_interrupt();
+	while (!bReplyDone && !bTimeout){
+		__bis_SR_register(LPM0_bits + GIE);
+		__disable_interrupt();
+	}
+	__enable_interrupt();
+	StopTimeout();
+	if (bReplyDone){
+		LastReadDelay = (GetTicks() - ulStart) / TICKS_PER_US;
+		if (LastReadDelay > DELAY_MAX_US)	// The reply can end after the Read Delay, ~LD shows 6 digits
+			LastReadDelay = DELAY_MAX_US;
+		if (LastReadDelay > MaxDelay)
+			MaxDelay = LastReadDelay;
+	}
+	if (!bAdcStreaming)
+		TACTL = TASSEL_2;		// SMCLK, timer off (for power consumption), unless it is triggering the ADC
+	bRXBit = false;
+	CCTL1 = 0;				// No more start bits
+	CCTL0 &= ~CCIE;			// Stop sampling a byte cut short by the timeout
+	CACTL1 &= ~CAON;		// Comparator off (for power consumption)
+
+//	P1SEL |= TXD;				// Connect TXD to timer pin
+//	CCTL0 |= OUT;				// Set TXD HIGH
+//	CCTL0 &= ~(OUTMOD2 + OUTMOD1 + OUTMOD0);			// Set TXD high
+
+	P1SEL &= ~TXD;				// Connect TXD to IO
+//	P1DIR |= TXD;				// Set TX pin as an output
+//	P1OUT &= ~TXD;				// Set Transmitter as Power Line
+	P1OUT &= ~TXD;				// Set TX Pin low to allow buss to go high
+	P1OUT |= BIT0; 				// Enable high current drive
+//	__delay_cycles (10000);
+
+	//ReceiveByte() has already filtered redundant data down to a single copy and judged the reply
+	//a reply that failed is replaced by ERROR, unless cut-through has already forwarded it
+	i = BUS_OK;
+	if (!bReplyDone){
+		uiTimeouts++;
+		i = BUS_TIMEOUT;
+	}else if (bFramingError){
+		uiFramingErrors++;
+		i = BUS_ERROR;
+	}else if (bCompareError){
+		if (bCrcFrame)
+			uiCrcErrors++;
+		else
+			uiCompareErrors++;
+		i = BUS_ERROR;
+	}else{
+		uiFramesOK++;
+	}
+	StatsRecord(Addr, i);
+	s = StatsFind(Addr);
+	if (bBusTrial && (s || cRecv >= 0))	// Only a serf that has answered before, or garbage now, says anything about the rate
+		BusTrial(i);
+	if (s)
+		s->Probe = (i == BUS_TIMEOUT && ulWait < *FlashReadDelay);	// Maybe it was only slow, learn from a full wait
+	if (i == BUS_OK || (i == BUS_TIMEOUT && !bRedundant))
+		return i;		// Forward whatever arrived
+	if (!bStreaming){
+		cSend = 0;			// Keep the address
+		SendText("ERROR");
+		SendBuf[++cSend] = 0x0D;
+	}
+	return i;
+}
+
+SerfStats *StatsFind(char Addr)
+{	// Slot of the serf at Addr, 0 if it is not tracked
+	unsigned char k;
+	for (k=0;k<STATS_SLOTS;k++)
+		if (Stats[k].Addr == Addr)
+			return &Stats[k];
+	return 0;
+}
+
+SerfStats *StatsTrack(char Addr)
+{	// Give Addr a free slot, 0 if all are taken
+	SerfStats *s = StatsFind(0);
+	if (s){
+		memset(s, 0, sizeof(SerfStats));
+		s->Addr = Addr;
+	}
+	return s;
+}
+
+void StatsRecord(char Addr, unsigned char Result)
+{	// Add the transaction that has just ended to the statistics of Addr
+	SerfStats *s;
+	unsigned long t;
+	unsigned char k;
+	if (Addr < ADDR_FIRST || Addr > ADDR_LAST)
+		return;
+	s = StatsFind(Addr);
+	if (s == 0){
+		if (Result == BUS_TIMEOUT && cRecv < 0)
+			return;					// Nothing there (yet), keep the slots for serfs that answer
+		s = StatsTrack(Addr);
+		if (s == 0)
+			return;					// All slots are taken
+	}
+	s->Bytes += cRecv + 1;
+	if (Result == BUS_TIMEOUT){
+		if (s->Timeouts < 255)
+			s->Timeouts++;
+		return;
+	}
+	if (Result == BUS_ERROR && s->Errors < 255)
+		s->Errors++;
+	t = LastReadDelay >> STATS_UNIT_SHIFT;
+	for (k=0;t && k<STATS_BINS-1;k++)
+		t >>= 1;
+	if (s->Hist[k] == 255)
+		for (t=0;t<STATS_BINS;t++)
+			s->Hist[t] >>= 1;
+	s->Hist[k]++;
+}
+
+unsigned char AdaptBin(char Addr)
+{	// Hist[] bin of Addr for the adaptive timeout, ADAPT_NONE while there is nothing to learn from
+	SerfStats *s = StatsFind(Addr);
+	unsigned int total = 0;
+	unsigned int sum = 0;
+	unsigned char k;
+	if (s){
+		if (s->Probe)
+			return ADAPT_NONE;
+		for (k=0;k<STATS_BINS;k++)
+			total += s->Hist[k];
+		if (total >= ADAPT_MIN_REPLIES){
+			total -= total >> ADAPT_PERCENTILE_SHIFT;
+			for (k=0;sum + s->Hist[k] < total;k++)
+				sum += s->Hist[k];
+			return k;
+		}
+	}
+	for (k=1;k<1+2*STATS_SLOTS;k+=2)	// Learned before ~AP
+		if (FlashAdapt[k] == Addr && (unsigned char)FlashAdapt[k+1] < STATS_BINS)
+			return FlashAdapt[k+1];
+	return ADAPT_NONE;
+}
+
+unsigned long ResponseTimeout(char Addr)
+{	// Microseconds to wait for the reply of the serf at Addr
+	unsigned long t = *FlashReadDelay;
+	unsigned long floor = *FlashAdaptFloor;
+	unsigned char k;
+	if (!bAdaptive)
+		return t;
+	k = AdaptBin(Addr);
+	if (k >= STATS_BINS - 1)
+		return t;
+	if (floor == 0xFFFFFFFF)
+		floor = ADAPT_FLOOR_DEFAULT;
+	if ((2UL << (STATS_UNIT_SHIFT + k)) < t)
+		t = 2UL << (STATS_UNIT_SHIFT + k);		// Bin k ends at 1 << k units
+	if (t < floor)
+		t = floor;
+	if (t > *FlashReadDelay)
+		t = *FlashReadDelay;
+	return t;
+}
 
-//				__delay_cycles (100);
+unsigned int CrcUpdate(unsigned int Crc, char c)
+{	// CRC-16/CCITT, one nibble at a time
+	Crc = (Crc << 4) ^ CrcTable[((Crc >> 12) ^ ((unsigned char)c >> 4)) & 0x0F];
+	Crc = (Crc << 4) ^ CrcTable[((Crc >> 12) ^ c) & 0x0F];
+	return Crc;
+}
+
+bool CrcAddress(char Addr)
+{	// true if the serf at Addr uses CRC-16 framing
+	if (Addr < ADDR_FIRST || Addr > ADDR_LAST)
+		return false;
+	Addr -= ADDR_FIRST;
+	return (FlashCrcMap[Addr >> 3] & (1 << (Addr & 7))) == 0;
+}
+
+char HexChar(unsigned char Nibble)
+{
+	Nibble &= 0x0F;
+	return Nibble < 10 ? '0' + Nibble : 'A' - 10 + Nibble;
+}
 
-				// Send to Controller
-				if(cSend > -1){
-					for(i=0;i<=cSend;i++){
-						UCA0TXBUF = SendBuf[i];
-						while (!(IFG2&UCA0TXIFG));                // USCI_A0 TX buffer ready?
-					}
+bool ReceiveByte(char c, unsigned char Flags)
+{	// Called by the receive ISR for every byte of a serf reply with its RX_ flags, returns true when the reply is complete
+	//Redundant data is the data sent two times, bounded by character SC (inside the Address and CR characters) and separated by character SC:
+	//	<Address> SC <data> SC <data> SC CR
+	//The first copy of the data is stored after the address, the second copy is compared against it as it arrives and is not stored,
+	//so the verdict (bFramingError, bCompareError) is ready when the CR lands
+	//CRC-16 framed replies are stored whole, their CRC is updated four bytes behind and checked against the hex digits on the CR
+	signed char r = ++cRecv;
+	signed char j;
+	if (Flags & RX_NOISE)
+		uiNoiseBytes++;
+	if (Flags & RX_FRAMING)
+		bFramingError = true;
+	if (c == 0x0D){
+		StopTimeout();
+		if (bRedundant && r != (cMiddle << 1))
+			bFramingError = true;		// Second copy is short or missing
+		if (bCrcFrame){					// Check and strip the 4 hex digits in front of the CR
+			if (r < 5 || r != cSend + 1){
+				bFramingError = true;
+			}else{
+				unsigned int v = 0;
+				for (j=cSend-3;j<=cSend;j++){
+					c = SendBuf[j];
+					v <<= 4;
+					if (c >= '0' && c <= '9')
+						v += c - '0';
+					else if (c >= 'A' && c <= 'F')
+						v += c - 'A' + 10;
+					else
+						bFramingError = true;
 				}
-			    cSend = -1;
-
-//				while (!(IFG2&UCA0TXIFG));                // USCI_A0 TX buffer ready?
-				UCA0TXBUF = 0x0A;  //send new line
-				while (!(IFG2&UCA0TXIFG));                // USCI_A0 TX buffer ready?
-
-//				P1SEL |= TXD;				// Connect TXD to timer pin
-//				CCTL0 |= OUT;				// Set TXD HIGH
-//				CCTL0 &= ~(OUTMOD2 + OUTMOD1 + OUTMOD0);			// Set TXD high
-
-				P1SEL &= ~TXD;				// Connect TXD to IO
-	//			P1DIR |= TXD;				// Set TX pin as an output
-	//			P1OUT &= ~TXD;				// Set Transmitter as Power Line
-				P1OUT &= ~TXD;				// Set TX Pin low to allow buss to go high
-				P1OUT |= BIT0; 				// Enable high current drive
-//				__delay_cycles (10000);
-				cCmd=-1;
+				if (v != (uiCrc & 0xFFFF))
+					bCompareError = true;
+				cSend -= 4;
 			}
-			IE2 |= UCA0RXIE;
+			c = 0x0D;
+		}
+		if (cSend < SEND_LEN - 1)
+			SendBuf[++cSend] = c;
+		else
+			SendBuf[cSend] = c;			// Reply was truncated, still terminate it
+		bReplyDone = true;
+		if (bStreaming)
+			StreamToController();
+		return true;
+	}
+	StartTimeout(CharGap_us);			// Expect the remaining characters to follow quickly
+	if (bCrcFrame){
+		if (r >= 4)
+			uiCrc = CrcUpdate(uiCrc, SendBuf[r-4]);	// Only bytes followed by four more can be data
+	}else if (r == 1 && c == SC){
+		bRedundant = true;				// The bounding SC is not stored
+		return false;
+	}
+	if (bRedundant && cMiddle >= 0){
+		j = r - cMiddle;				// Second copy, compare with the stored first copy
+		if (j < cMiddle - 1){
+			if (c != SendBuf[j])
+				bCompareError = true;
+		}else if (j == cMiddle - 1){
+			if (c != SC)
+				bFramingError = true;	// Closing SC missing
+		}else{
+			bFramingError = true;		// Data after the closing SC
 		}
+		return false;
 	}
+	if (c == SC && !bCrcFrame){
+		if (bRedundant){
+			cMiddle = r;				// The separating SC is not stored
+			return false;
+		}
+		bFramingError = true;			// SC inside a reply that did not start with one
+	}
+	if (cSend < SEND_LEN - 1)
+		SendBuf[++cSend] = c;
+	else
+		bFramingError = true;			// Reply too long for SendBuf
+	if (!bStreaming && bStreamReply && r == 1 && !bCrcFrame)
+		bStreaming = true;				// Not a redundant reply, nothing left to filter, so forward it right away
+	if (bStreaming)
+		StreamToController();
+	return false;
 }
 
-void ExecuteCommand(void){
+// Master command handlers, called by ExecuteCommand() once the schema in CmdTable[] is met
+// Args is the number of parameter characters after the ':', CMD_BARE for the form without ':'
+// A handler adds its reply to SendBuf after the ID, or returns false to have the parameters rejected with NO
+
+bool CmdFV(signed char Args)
+{	// Firmware Version
+	SendBuf[++cSend]=FWType1;
+	SendBuf[++cSend]=FWType0;
+	SendBuf[++cSend]=Version1;
+	SendBuf[++cSend]=Version0;
+	return true;
+}
+
+bool CmdAD(signed char Args)
+{	// AD measurement <channel V, T, 3-7>[Vref 1, 2 or 3, default 3]
+	unsigned int inch = INCH_11;
+	char Vref = 3;
+	P1OUT |= BIT7;				// Initialize P1.7 High - Used to power the sensors (settles together with the Ref in Average_Measure)
+	if(CmdBuf[4] == 'V')
+		inch = INCH_11;
+	if(CmdBuf[4] == 'T')
+		inch = INCH_10;
+	if(CmdBuf[4] >= '3' && CmdBuf[4] <= '7')
+		inch = (unsigned int)(CmdBuf[4] - '0') << 12;
+	if(CmdBuf[5] >= '1' && CmdBuf[5] <= '3')
+		Vref = CmdBuf[5] - '0';
+	Average_Measure(inch, Vref);
+	return true;
+}
+
+bool CmdAS(signed char Args)
+{	// AD Scan [:<Vref 1, 2 or 3><channels V, T, 3-7>], all channels with Vref 3 when no parameters
+	// Reply: the values in the order requested, separated by ','
+	unsigned char i;
+	if(Args == CMD_BARE){
+		P1OUT |= BIT7;				// Initialize P1.7 High - Used to power the sensors (settles together with the Ref)
+		memcpy(&CmdBuf[5], "VT34567", 7);	// Scan_Measure() works on the channels in place
+		Scan_Measure(&CmdBuf[5], 7, 3);
+		return true;
+	}
+	for(i=5;i<cCmd && (CmdBuf[i] == 'V' || CmdBuf[i] == 'T' || (CmdBuf[i] >= '3' && CmdBuf[i] <= '7'));i++);
+	if(Args < 2 || i != cCmd || CmdBuf[4] < '1' || CmdBuf[4] > '3')
+		return false;
+	P1OUT |= BIT7;				// Initialize P1.7 High - Used to power the sensors (settles together with the Ref)
+	Scan_Measure(&CmdBuf[5], Args - 1, CmdBuf[4] - '0');
+	return true;
+}
+
+bool CmdAC(signed char Args)
+{	// AD Continuous <channel V, T, 3-7><Vref 1, 2 or 3>:<samples per second 1-8000>, no parameters stops it
+	unsigned long l;
 	unsigned int inch;
-	char Vref;
+	if(Args == CMD_BARE){
+		StopADCStream();
+		SendOKNO(true);
+		return true;
+	}
+	inch = CmdBuf[4] == 'V' ? INCH_11 : CmdBuf[4] == 'T' ? INCH_10 : (unsigned int)(CmdBuf[4] - '0') << 12;
+	if(bAdcStreaming || CmdBuf[6] != ':' || ParseNumber(7, 0, ADC_STREAM_MAX_RATE, &l) != cCmd || l == 0
+			|| (CmdBuf[4] != 'V' && CmdBuf[4] != 'T' && (CmdBuf[4] < '3' || CmdBuf[4] > '7')) || CmdBuf[5] < '1' || CmdBuf[5] > '3')
+		return false;
+	P1OUT |= BIT7;				// Initialize P1.7 High - Used to power the sensors
+	StartADCStream(inch, CmdBuf[5] - '0', 16000000 / l);	// The first frame is sent after this reply
+	SendOKNO(true);
+	return true;
+}
+
+bool CmdAO(signed char Args)
+{	// AD Oversampling <0 = 16, 1 = 64, 2 = 256 samples><0 = average, 1 = decimate to 12, 13 or 14 bits>
+	if(Args == CMD_BARE){
+		SendBuf[++cSend] = '0' + ucOversample;
+		SendBuf[++cSend] = bDecimate ? '1' : '0';
+		return true;
+	}
+	if(CmdBuf[4] < '0' || CmdBuf[4] > '2' || (CmdBuf[5] != '0' && CmdBuf[5] != '1'))
+		return false;
+	ucOversample = CmdBuf[4] - '0';
+	bDecimate = (CmdBuf[5] == '1');
+	SendOKNO(true);
+	return true;
+}
+
+bool CmdRD(signed char Args)
+{	// Read Delay in microseconds <accepts decimal> (recommend 300000)
+	unsigned long l;
+	if(Args == CMD_BARE){
+		TransmitLongValue(*FlashReadDelay);
+		return true;
+	}
+	if(ParseNumber(4, 0, DELAY_MAX_US, &l) != cCmd)
+		return false;
+	SendOKNO(ConfigWrite(CFG_READ_DELAY,(char *)&l,4));
+	return true;
+}
+
+bool CmdLD(signed char Args)
+{	// Last Delay (microseconds from the end of the request to the CR of the reply, saturates at DELAY_MAX_US)
+	TransmitLongValue(LastReadDelay);
+	return true;
+}
+
+bool CmdMD(signed char Args)
+{	// Max Delay (microseconds, saturates at DELAY_MAX_US)
+	TransmitLongValue(MaxDelay);
+	MaxDelay = 0;
+	return true;
+}
+
+bool CmdWL(signed char Args)
+{	// Wake Latency <last>,<max> (microseconds from the CR of a master command to its reply being queued, saturates at DELAY_MAX_US)
+	TransmitLongValue(LastReplyLatency);
+	TransmitSeparator(',');
+	TransmitLongValue(MaxReplyLatency);
+	MaxReplyLatency = 0;
+	return true;
+}
+
+bool CmdCT(signed char Args)
+{	// Cut-Through forwarding <0 = off, 1 = on>
+	if(Args == CMD_BARE){
+		SendBuf[++cSend] = bCutThrough ? '1' : '0';
+		return true;
+	}
+	if(CmdBuf[4] != '0' && CmdBuf[4] != '1')
+		return false;
+	bCutThrough = (CmdBuf[4] == '1');
+	SendOKNO(true);
+	return true;
+}
+
+bool CmdBR(signed char Args)
+{	// Baud Rates <controller index><bus index>, 0=9600 1=19200 2=38400 3=57600 4=115200, the bus runs at 0 or 1 (BUS_RATES)
+	// The new rates must be confirmed by a master command at the new rates within ~2s, otherwise the old rates return
+	// A new bus rate is stored once a serf answers at it, BUS_TRIAL_MISSES failed transactions with serfs that
+	// answered before (or garbled replies) return it to 9600 first
+	if(Args == CMD_BARE){
+		SendBuf[++cSend] = '0' + (ucBaudActive & 0x0F);
+		SendBuf[++cSend] = '0' + (ucBaudActive >> 4);
+		return true;
+	}
+	if(CmdBuf[4] < '0' || CmdBuf[4] >= '0' + UART_RATES || CmdBuf[5] < '0' || CmdBuf[5] >= '0' + BUS_RATES)
+		return false;
+	ucBaudRequest = ((CmdBuf[5] - '0') << 4) | (CmdBuf[4] - '0');
+	bBaudRequest = true;
+	SendOKNO(true);
+	return true;
+}
+
+bool CmdBA(signed char Args)
+{	// BAtch poll <serf addresses>:<command>, e.g. ~BA:ABC:RT
+	// Reply: ~<reply of the first serf>|<reply of the next serf>|... (without their CRs)
+	// a serf that does not answer gives <address>TIMEOUT, a redundancy error gives <address>ERROR
+	unsigned char i;
+	unsigned char n;
+	for(n=4;n<cCmd && CmdBuf[n] != ':';n++);
+	if(n == 4 || n+1 >= cCmd)
+		return false;
+	SendToController();		// The ID goes out first, each serf reply follows as soon as it is complete
+	for(i=4;i<n;i++){
+		if(i > 4 && !bBinary)
+			UartPut('|');		// Binary mode sends every serf reply as a frame of its own
+		if(SerfAbsent(CmdBuf[i])){
+			cSend = 0;
+			SendBuf[0] = CmdBuf[i];
+			SendText("NOSERF");
+		}else if(BusTransaction(CmdBuf[i], &CmdBuf[n+1], false) == BUS_TIMEOUT){
+			cSend = 0;
+			SendBuf[0] = CmdBuf[i];
+			SendText("TIMEOUT");
+		}else{
+			cSend--;		// Drop the CR
+		}
+		SendToController();
+	}
+	return true;
+}
+
+bool CmdSE(signed char Args)
+{	// Schedule Entry <slot>:<serf address>:<period in 0.1s>:<serf command>, <slot> alone clears it
+	char a[sizeof(ScheduleEntry)];
+	unsigned char n = CmdBuf[4] - '0';
+	unsigned long l;
+	signed char i;
+	unsigned char j;
+	if(n >= SCHED_SLOTS)
+		return false;
+	for(j=0;j<sizeof(a);j++)
+		a[j] = 0xFF;
+	if(Args > 1){
+		i = ParseNumber(8, 0, SCHED_MAX_PERIOD, &l);
+		if(CmdBuf[5] != ':' || CmdBuf[7] != ':' || i < 0 || CmdBuf[i] != ':' || l == 0 || cCmd - i > SCHED_CMD_LEN)
+			return false;
+		a[0] = CmdBuf[6];
+		for(j=1;++i<=cCmd;j++)
+			a[j] = CmdBuf[i];		// Command and its CR
+		a[sizeof(a)-2] = l;
+		a[sizeof(a)-1] = l>>8;
+	}
+	if(!ConfigWrite(CFG_SCHEDULE + n,a,sizeof(a)))
+		return false;
+	SchedReply[n][0] = 0;
+	SchedDue[n] = uiTimerHigh;
+	SendOKNO(true);
+	return true;
+}
+
+bool CmdSL(signed char Args)
+{	// Schedule List <slot>, replies <serf address>:<period in 0.1s>:<serf command>
+	unsigned char n = CmdBuf[4] - '0';
+	unsigned char i;
+	if(n >= SCHED_SLOTS || FlashSchedule(n)->Addr == (char)0xFF)
+		return false;
+	SendBuf[++cSend] = FlashSchedule(n)->Addr;
+	TransmitSeparator(':');
+	TransmitValue(FlashSchedule(n)->Period);
+	TransmitSeparator(':');
+	for(i=0;i<SCHED_CMD_LEN && FlashSchedule(n)->Cmd[i] != 0x0D;i++)
+		SendBuf[++cSend] = FlashSchedule(n)->Cmd[i];
+	return true;
+}
+
+bool CmdSR(signed char Args)
+{	// Schedule Read <slot>, replies the cached serf reply and its age: <reply>,<age in 0.1s, saturates at 10737>
+	unsigned char n = CmdBuf[4] - '0';
+	unsigned char i;
+	if(n >= SCHED_SLOTS || SchedReply[n][0] == 0){
+		SendText("NODATA");
+		return true;
+	}
+	for(i=0;i<SCHED_REPLY_LEN && SchedReply[n][i];i++)
+		SendBuf[++cSend] = SchedReply[n][i];
+	TransmitSeparator(',');
+	TransmitValue(TicksToTenths(uiTimerHigh - SchedStamp[n]));
+	return true;
+}
+
+bool CmdVS(signed char Args)
+{	// Validator Statistics <frames OK>,<framing errors>,<compare mismatches>,<timeouts>,<CRC errors>,<bytes outvoted a noisy sample>
+	TransmitValue(uiFramesOK);
+	TransmitSeparator(',');
+	TransmitValue(uiFramingErrors);
+	TransmitSeparator(',');
+	TransmitValue(uiCompareErrors);
+	TransmitSeparator(',');
+	TransmitValue(uiTimeouts);
+	TransmitSeparator(',');
+	TransmitValue(uiCrcErrors);
+	TransmitSeparator(',');
+	TransmitValue(uiNoiseBytes);
+	return true;
+}
+
+bool CmdSH(signed char Args)
+{	// Stats Histogram <serf address>, replies the 8 reply delay bins: <2ms>,<4ms>,<8ms>,...,<131ms>,<longer>
+	// NODATA for a serf without one of the STATS_SLOTS (4) slots, see ~ST: and ~SX:
+	SerfStats *s = StatsFind(CmdBuf[4]);
+	unsigned char i;
+	if(s == 0){
+		SendText("NODATA");
+		return true;
+	}
+	for(i=0;i<STATS_BINS;i++){
+		if(i > 0)
+			TransmitSeparator(',');
+		TransmitValue(s->Hist[i]);
+	}
+	return true;
+}
+
+bool CmdSN(signed char Args)
+{	// Stats Numbers <serf address>, replies <timeouts>,<errors>,<bytes received>, NODATA like ~SH:
+	SerfStats *s = StatsFind(CmdBuf[4]);
+	if(s == 0){
+		SendText("NODATA");
+		return true;
+	}
+	TransmitValue(s->Timeouts);
+	TransmitSeparator(',');
+	TransmitValue(s->Errors);
+	TransmitSeparator(',');
+	TransmitValue(s->Bytes);
+	return true;
+}
+
+bool CmdST(signed char Args)
+{	// Stats Track <serf address>, takes one of the STATS_SLOTS slots for it, NO when all are taken by other serfs
+	SendOKNO(StatsFind(CmdBuf[4]) || StatsTrack(CmdBuf[4]));
+	return true;
+}
+
+bool CmdSX(signed char Args)
+{	// Stats eXpunge [serf address], clears the statistics of that serf, or of all, and frees their slots
+	SerfStats *s;
+	if(Args == CMD_BARE){
+		memset(Stats, 0, sizeof(Stats));
+	}else{
+		s = StatsFind(CmdBuf[4]);
+		if(s)
+			memset(s, 0, sizeof(SerfStats));
+	}
+	SendOKNO(true);
+	return true;
+}
+
+bool CmdAE(signed char Args)
+{	// Adaptive timeout Enable <0 = always wait the Read Delay, 1 = learn per serf>
+	if(Args == CMD_BARE){
+		SendBuf[++cSend] = bAdaptive ? '1' : '0';
+		return true;
+	}
+	if(CmdBuf[4] != '0' && CmdBuf[4] != '1')
+		return false;
+	bAdaptive = (CmdBuf[4] == '1');
+	SendOKNO(true);
+	return true;
+}
+
+bool CmdAF(signed char Args)
+{	// Adaptive timeout Floor in microseconds <accepts decimal>
+	unsigned long l;
+	if(Args == CMD_BARE){
+		l = *FlashAdaptFloor;
+		TransmitLongValue(l == 0xFFFFFFFF ? ADAPT_FLOOR_DEFAULT : l);
+		return true;
+	}
+	if(ParseNumber(4, 0, DELAY_MAX_US, &l) != cCmd)
+		return false;
+	SendOKNO(ConfigWrite(CFG_ADAPT_FLOOR,(char *)&l,4));
+	return true;
+}
+
+bool CmdAT(signed char Args)
+{	// Adaptive Timeout <serf address>, the wait for its next reply (microseconds)
+	TransmitLongValue(ResponseTimeout(CmdBuf[4]));
+	return true;
+}
+
+bool CmdAP(signed char Args)
+{	// Adaptive timeout Persist, stores the enable and the learned bins
+	char a[1 + 2*STATS_SLOTS];
+	unsigned char i;
+	a[0] = bAdaptive ? 1 : 0;
+	for(i=0;i<STATS_SLOTS;i++){
+		a[1+2*i] = Stats[i].Addr;
+		a[2+2*i] = Stats[i].Addr ? AdaptBin(Stats[i].Addr) : ADAPT_NONE;
+	}
+	SendOKNO(ConfigWrite(CFG_ADAPT,a,sizeof(a)));
+	return true;
+}
+
+bool CmdDS(signed char Args)
+{	// Discovery Scan <first address><last address>, replies the addresses that answered FV
 	unsigned int i;
-	bool PF = true;
-	unsigned int low;
-	unsigned int high;
+	if(CmdBuf[5] > ADDR_LAST || CmdBuf[4] > CmdBuf[5])
+		return false;
+	SendToController();		// The ID goes out first, the addresses follow as they are found
+	for(i=CmdBuf[4];i<=(unsigned char)CmdBuf[5];i++){
+		if(DiscoverSerf(i)){
+			SendBuf[++cSend] = i;
+			SendToController();
+		}
+	}
+	return true;
+}
+
+bool CmdDX(signed char Args)
+{	// Discovery eXpunge, forget the absent serfs
+	memset(AbsentMap, 0, sizeof(AbsentMap));
+	SendOKNO(true);
+	return true;
+}
+
+bool CmdRP(signed char Args)
+{	// Retry Policy <retries 0-9>:<gap in milliseconds>
 	unsigned long l;
+	char a[4];
+	if(Args == CMD_BARE){
+		TransmitValue((unsigned char)*FlashRetryCount > RETRY_MAX ? 0 : *FlashRetryCount);
+		TransmitSeparator(':');
+		TransmitValue(*FlashRetryGap > RETRY_MAX_GAP ? 0 : *FlashRetryGap);
+		return true;
+	}
+	if(CmdBuf[5] != ':' || ParseNumber(6, 0, RETRY_MAX_GAP, &l) != cCmd || CmdBuf[4] < '0' || CmdBuf[4] > '0' + RETRY_MAX)
+		return false;
+	a[0] = CmdBuf[4] - '0';
+	a[1] = 0xFF;
+	a[2] = l;
+	a[3] = l >> 8;
+	SendOKNO(ConfigWrite(CFG_RETRY,a,4));
+	return true;
+}
+
+bool CmdRW(signed char Args)
+{	// Retry Whitelist <up to 4 two character serf commands>, e.g. ~RW:RTAD, nothing clears it
+	char a[2*RETRY_WHITELIST];
+	unsigned char i;
+	if(Args == CMD_BARE){
+		for(i=0;i<2*RETRY_WHITELIST && FlashRetryWhitelist[i] != (char)0xFF;i++)
+			SendBuf[++cSend] = FlashRetryWhitelist[i];
+		return true;
+	}
+	if(Args % 2)
+		return false;
+	for(i=0;i<sizeof(a);i++)
+		a[i] = i < Args ? CmdBuf[4+i] : 0xFF;
+	SendOKNO(ConfigWrite(CFG_RETRY_WHITELIST,a,sizeof(a)));
+	return true;
+}
+
+bool CmdCM(signed char Args)
+{	// CRC Mode <serf address>[0 = redundant data, 1 = CRC-16 framing]
+	char b[(ADDR_LAST - ADDR_FIRST + 8) / 8];
+	unsigned char n = CmdBuf[4] - ADDR_FIRST;
+	if(Args == 1){
+		SendBuf[++cSend] = CrcAddress(CmdBuf[4]) ? '1' : '0';
+		return true;
+	}
+	if(CmdBuf[5] != '0' && CmdBuf[5] != '1')
+		return false;
+	memcpy(b, FlashCrcMap, sizeof(b));
+	b[n >> 3] |= 1 << (n & 7);
+	if(CmdBuf[5] == '1')
+		b[n >> 3] &= ~(1 << (n & 7));
+	SendOKNO(ConfigWrite(CFG_CRC_MAP,b,sizeof(b)));
+	return true;
+}
+
+bool CmdBM(signed char Args)
+{	// Binary Mode <0 = ASCII, 1 = binary frames>, this reply still uses the old mode
+	if(Args == CMD_BARE){
+		SendBuf[++cSend] = bBinary ? '1' : '0';
+		return true;
+	}
+	if(CmdBuf[4] != '0' && CmdBuf[4] != '1')
+		return false;
+	bBinaryRequest = (CmdBuf[4] == '1');
+	SendOKNO(true);
+	return true;
+}
+
+bool CmdRS(signed char Args)
+{	// Reset Serfs [:<milliseconds to hold the bus low, default 5000>], replies OK now and ~DONE when the bus is released
+	unsigned long l = RESET_DEFAULT_MS;
+	if(Args != CMD_BARE && (ParseNumber(4, 0, RESET_MAX_MS, &l) != cCmd || l == 0))
+		return false;
+	P1OUT &= ~BIT0; 		// Disable high current drive
+	P1OUT |= TXD;				// Set TX Pin high to drive bus low
+	uiResetDeadline = uiTimerHigh + (unsigned int)((l * 125) >> 12) + 1;	// Milliseconds to 32.768ms ticks, rounded up
+	bResetting = true;
+	SendOKNO(true);
+	return true;
+}
+
+// Command registry, X(<letters>, <handler>, <flags>, <fewest parameter characters>, <most>, <longest reply>)
+#define		MASTER_COMMANDS(X) \
+	X('F','V', CmdFV, 0,					CMD_BARE, CMD_BARE,				4) \
+	X('A','D', CmdAD, CMD_ADC,			1,        2,					5) \
+	X('A','S', CmdAS, CMD_ADC,			CMD_BARE, 1 + ADC_SCAN_MAX,		SEND_LEN - 2)	/* Scan_Measure() sends before SendBuf fills */ \
+	X('A','C', CmdAC, 0,					CMD_BARE, 7,					2) \
+	X('A','O', CmdAO, 0,					CMD_BARE, 2,					2) \
+	X('R','D', CmdRD, 0,					CMD_BARE, 10,					7) \
+	X('L','D', CmdLD, 0,					CMD_BARE, CMD_BARE,				7) \
+	X('M','D', CmdMD, 0,					CMD_BARE, CMD_BARE,				7) \
+	X('W','L', CmdWL, 0,					CMD_BARE, CMD_BARE,				15) \
+	X('C','T', CmdCT, 0,					CMD_BARE, 1,					2) \
+	X('B','R', CmdBR, 0,					CMD_BARE, 2,					2) \
+	X('B','A', CmdBA, CMD_BUS,			3,        CMD_LEN - 5,			SEND_LEN - 1)	/* One serf reply at a time */ \
+	X('S','E', CmdSE, 0,					1,        CMD_LEN - 5,			2) \
+	X('S','L', CmdSL, 0,					1,        1,					14) \
+	X('S','R', CmdSR, 0,					1,        1,					SCHED_REPLY_LEN + 6) \
+	X('V','S', CmdVS, 0,					CMD_BARE, CMD_BARE,				35) \
+	X('S','H', CmdSH, CMD_ADDR,			1,        1,					4 * STATS_BINS - 1) \
+	X('S','N', CmdSN, CMD_ADDR,			1,        1,					13) \
+	X('S','T', CmdST, CMD_ADDR,			1,        1,					2) \
+	X('S','X', CmdSX, CMD_ADDR,			CMD_BARE, 1,					2) \
+	X('A','E', CmdAE, 0,					CMD_BARE, 1,					2) \
+	X('A','F', CmdAF, 0,					CMD_BARE, 10,					7) \
+	X('A','T', CmdAT, CMD_ADDR,			1,        1,					7) \
+	X('A','P', CmdAP, 0,					CMD_BARE, CMD_BARE,				2) \
+	X('D','S', CmdDS, CMD_BUS + CMD_ADDR,	2,        2,					4) \
+	X('D','X', CmdDX, 0,					CMD_BARE, CMD_BARE,				2) \
+	X('R','P', CmdRP, 0,					CMD_BARE, 7,					7) \
+	X('R','W', CmdRW, 0,					CMD_BARE, 2 * RETRY_WHITELIST,	2 * RETRY_WHITELIST) \
+	X('C','M', CmdCM, CMD_ADDR,			1,        2,					2) \
+	X('B','M', CmdBM, 0,					CMD_BARE, 1,					2) \
+	X('R','S', CmdRS, CMD_BUS,			CMD_BARE, 5,					4)
+const MasterCommand CmdTable[CMD_TABLE] = {
+	MASTER_COMMANDS(CMD)
+};
+
+// Never called: the same list as case labels, so two commands with one CMD_HASH() slot stop the build as duplicate cases,
+// and a reply that does not fit SendBuf as an array of negative size
+#define		CMD_CASE(a, b, Handler, Flags, ArgMin, ArgMax, MaxReply) \
+	case CMD_HASH(a, b) + 0 * sizeof(char[(MaxReply) < SEND_LEN ? 1 : -1]):
+static inline void CmdHashCheck(void)
+{
+	switch (0){
+	MASTER_COMMANDS(CMD_CASE)
+		break;
+	}
+}
+
+void ExecuteCommand(void){
+	// Look the command up in CmdTable[], check its parameters against the schema and run its handler
+	const MasterCommand *c = &CmdTable[CMD_HASH((unsigned char)CmdBuf[1], (unsigned char)CmdBuf[2])];
+	signed char Args = cCmd == 3 ? CMD_BARE : cCmd - 4;
 
 	SendBuf[++cSend]=ID;		// First load the Comm ID
 
-	//Send Firmware Version
-	if((CmdBuf[1] == 'F') && (CmdBuf[2] == 'V')){
-		SendBuf[++cSend]=FWType1;
-		SendBuf[++cSend]=FWType0;
-		SendBuf[++cSend]=Version1;
-		SendBuf[++cSend]=Version0;
-	}
-	else if((CmdBuf[1] == 'A') && (CmdBuf[2] == 'D') && (CmdBuf[3] == ':')){
-		P1OUT |= BIT7;				// Initialize P1.7 High - Used to power the sensors
-		_delay_cycles (4095);
-		inch = INCH_11;	//Initialize
-		Vref = 3;		//Initialize
-		if(CmdBuf[4] == 'V')
-			inch = INCH_11;
-		if(CmdBuf[4] == 'T')
-			inch = INCH_10;
-		if(CmdBuf[4] == '3')
-			inch = INCH_3;
-		if(CmdBuf[4] == '4')
-			inch = INCH_4;
-		if(CmdBuf[4] == '5')
-			inch = INCH_5;
-		if(CmdBuf[4] == '6')
-			inch = INCH_6;
-		if(CmdBuf[4] == '7')
-			inch = INCH_7;
-		if(CmdBuf[5] == '1')
-			Vref = 1;
-		if(CmdBuf[5] == '2')
-			Vref = 2;
-		if(CmdBuf[5] == '3')
-			Vref = 3;
-		Average_Measure(inch, Vref);
-	}else if((CmdBuf[1] == 'R') && (CmdBuf[2] == 'D') && (CmdBuf[3] == ':')){ // program Read Delay <accepts decimal>  (for 16MHz, recommend 300000)
-		l = ConvertAdvCmdParameterFloatToHex(0,0);
-		char a[4];
-		a[3] = 0;
-		a[2] = l>>16;
-		a[1] = l>>8;
-		a[0] = l;
-		void *ptr = FlashReadDelay;
-		PF = ProgramFlashInfoSegment(Flash_ptrD,ptr,a,4);
-		SendOKNO(PF);
-	}else if((CmdBuf[1] == 'R') && (CmdBuf[2] == 'D')){ // Read Delay
-		low = *FlashReadDelay;
-		high = (*FlashReadDelay >> 16) & 0X00FF;
-		TransmitExtendedDecimal(high,low,0);
-	}else if((CmdBuf[1] == 'L') && (CmdBuf[2] == 'D')){ // Last Delay
-		low = LastReadDelay;
-		high = (LastReadDelay >> 16) & 0X00FF;
-		TransmitExtendedDecimal(high,low,0);
-	}else if((CmdBuf[1] == 'M') && (CmdBuf[2] == 'D')){ // Max Delay
-		low = MaxDelay;
-		high = (MaxDelay >> 16) & 0X00FF;
-		TransmitExtendedDecimal(high,low,0);
-		MaxDelay = 0;
-	}else if((CmdBuf[1] == 'R') && (CmdBuf[2] == 'S')){ // Reset Serfs
-		P1OUT &= ~BIT0; 		// Disable high current drive
-		P1OUT |= TXD;				// Set TX Pin high to drive bus low
-		for(i=0;i<5;i++)
-			__delay_cycles (16000000);
-		P1OUT &= ~TXD;				// Set TX Pin low to allow bus to go high
-		P1OUT |= BIT0; 		// Enable high current drive
-		SendBuf[++cSend]='D';
-		SendBuf[++cSend]='O';
-		SendBuf[++cSend]='N';
-		SendBuf[++cSend]='E';
+	if(c->Handler == 0 || c->Name[0] != CmdBuf[1] || c->Name[1] != CmdBuf[2]){
+		// Unknown command, the reply is the ID alone
+	}else if(((c->Flags & CMD_ADC) && bAdcStreaming) || ((c->Flags & CMD_BUS) && bResetting)){
+		SendText("BUSY");		// The ADC is busy streaming (~AC stops it) or the bus is held low by ~RS
+	}else if(Args < c->ArgMin || Args > c->ArgMax || ((c->Flags & CMD_ADDR) && Args != CMD_BARE && (CmdBuf[4] < ADDR_FIRST || CmdBuf[4] > ADDR_LAST))
+			|| !c->Handler(Args)){
+		cSend = 0;				// Drop a partial reply
+		SendOKNO(false);
 	}
 
 	CmdBuf[3] = ' ';
 	CmdBuf[4] = ' ';
 	CmdBuf[5] = ' ';
 
-	SendBuf[++cSend]=0x0D;
+	if(!bBinary)
+		SendBuf[++cSend]=0x0D;
 
-	for(i=0;i<=cSend;i++){
-		UCA0TXBUF = SendBuf[i];
-		while (!(IFG2&UCA0TXIFG));                // USCI_A0 TX buffer ready?
-	}
-	cSend=-1;				// Reset SendBuf Index pointer
+	SendToController();		// Queue reply and reset SendBuf Index pointer
+	bBinary = bBinaryRequest;
 	cCmd=-1;				// reset RX byte counter
 }
 
-void Transmit(void)
+void UartPut(char c)
+{	// Queue one byte for the controller, only waits when the ring is full
+	// A reply longer than the ring (up to SEND_LEN, ~40ms at 9600) sleeps in LPM0 until USCI0TX_ISR frees a slot
+	unsigned char next = (ucTxHead + 1) & (TX_RING_SIZE - 1);
+	__disable_interrupt();
+	while (next == ucTxTail){
+		__bis_SR_register(LPM0_bits + GIE);
+		__disable_interrupt();
+	}
+	__enable_interrupt();
+	TxRing[ucTxHead] = c;
+	ucTxHead = next;
+	IE2 |= UCA0TXIE;				// (Re)start the drain, TXIFG is set whenever UCA0TXBUF is empty
+}
+
+bool UartTryPut(char c)
+{	// Queue one byte for the controller without waiting, for use by the ISRs
+	// Returns false when the ring is full
+	unsigned char next = (ucTxHead + 1) & (TX_RING_SIZE - 1);
+	if (next == ucTxTail)
+		return false;
+	TxRing[ucTxHead] = c;
+	ucTxHead = next;
+	IE2 |= UCA0TXIE;
+	return true;
+}
+
+void SendToController(void)
+{	// Queue SendBuf[cStreamed+1..cSend] for the controller and reset SendBuf, as one frame in binary mode
+	signed char i;
+	unsigned char sum;
+	if(bBinary){
+		sum = BIN_SYNC + (unsigned char)(cSend - cStreamed);
+		UartPut(BIN_SYNC);
+		UartPut(cSend - cStreamed);
+		for(i=cStreamed+1;i<=cSend;i++){
+			UartPut(SendBuf[i]);
+			sum += (unsigned char)SendBuf[i];
+		}
+		UartPut(sum);
+	}else{
+		for(i=cStreamed+1;i<=cSend;i++)
+			UartPut(SendBuf[i]);
+	}
+	cSend = -1;
+	cStreamed = -1;
+}
+
+void StreamToController(void)
+{	// Cut-through: queue the received bytes that have not been sent yet
+	// If the ring is full the rest stays in SendBuf and main() sends it after the reply is complete
+	while (cStreamed < cSend && UartTryPut(SendBuf[cStreamed+1]))
+		cStreamed++;
+}
+
+unsigned long GetTicks(void)
+{	// Free running 2MHz time stamp from Timer1_A, wraps after about 35 minutes
+	unsigned int sr = __get_SR_register() & GIE;
+	unsigned int high;
+	unsigned int low;
+	__disable_interrupt();
+	high = uiTimerHigh;
+	low = TA1R;
+	if ((TA1CTL & TAIFG) && low < 0x8000)	// Overflow happened but TIMER1_A1_ISR has not counted it yet
+		high++;
+	__bis_SR_register(sr);
+	return ((unsigned long)high << 16) | low;
+}
+
+void StartTimeout(unsigned long us)
+{	// Set bTimeout (and wake from LPM0) 'us' microseconds from now using Timer1_A CCR1
+	unsigned long ticks = us * TICKS_PER_US;
+	if ((ticks & 0xFFFF) < 32)		// Keep the first compare far enough ahead of TA1R not to be missed
+		ticks += 32;
+	TA1CCTL1 &= ~CCIE;
+	bTimeout = false;
+	uiTimeoutWraps = ticks >> 16;
+	TA1CCR1 = TA1R + (unsigned int)ticks;
+	TA1CCTL1 = CCIE;				// Compare mode, clear CCIFG, enable interrupt
+}
+
+void StopTimeout(void)
 {
-	unsigned int i = 0;
+	TA1CCTL1 &= ~CCIE;
+}
+
+void SetBaudRates(unsigned char Rates)
+{	// Rates: low nibble controller UART rate index, high nibble bus rate index, invalid indexes select 9600
+	unsigned char c = Rates & 0x0F;
+	unsigned char b = Rates >> 4;
+	if (c >= UART_RATES)
+		c = 0;
+	if (b >= BUS_RATES)
+		b = 0;
+	while (ucTxTail != ucTxHead || (UCA0STAT & UCBUSY))	// Let queued replies go out at the old rate
+		HAL_IDLE();
+	UCA0CTL1 |= UCSWRST;				// Disable USCI (also clears UCA0RXIE and UCA0TXIE)
+	UCA0MCTL = UartModulation[c];
+	UCA0BR0 = UartDivisor[c] & 0xFF;
+	UCA0BR1 = UartDivisor[c] >> 8;
+	UCA0CTL1 &= ~UCSWRST;
+	IE2 |= UCA0RXIE;
+	uiBitTime = BusBitTime[b];
+	uiRxGap = uiBitTime / (2 * RX_SAMPLES);		// The samples cover the middle of the bit
+	ucRxSamples = uiRxGap < RX_MIN_GAP ? 1 : RX_SAMPLES;
+	uiRxFirst = (uiBitTime >> 1) - (ucRxSamples >> 1) * uiRxGap;
+	uiRxNext = uiBitTime - (ucRxSamples - 1) * uiRxGap;
+	ucBaudActive = (b << 4) | c;
+}
+
+void BaudStore(unsigned char Mask)
+{	// Store the bits of ucBaudActive selected by Mask as the confirmed rates (0x0F controller, 0xF0 bus)
+	unsigned char r = ((unsigned char)*FlashBaudRates & ~Mask) | (ucBaudActive & Mask);
+	if (r != (unsigned char)*FlashBaudRates)
+		ConfigWrite(CFG_BAUD_RATES,(char *)&r,1);
+}
+
+void BusTrial(unsigned char Result)
+{	// Result of a transaction at an unproven bus rate: a valid reply has main() store the rate, BUS_TRIAL_MISSES
+	// failures in a row (timeouts or garbled replies, which a wrong rate gives as well) return the bus to 9600
+	// A timeout only counts for a serf with a Stats[] slot, an address that never answered (a discovery scan) says nothing
+	if (Result == BUS_OK){
+		bBusTrial = false;
+		bBusProven = true;
+	}else if (++ucBusMisses >= BUS_TRIAL_MISSES){
+		bBusTrial = false;
+		SetBaudRates(ucBaudActive & 0x0F);
+	}
+}
+
+void Transmit(char *Frame, unsigned char Length)
+{	// Start sending Length bytes of Frame (at least one), TIMER0_A0_ISR sets bTxDone when it is on the bus
+	// The bytes follow each other without idle time, the start bit comes right after the previous stop bit
+	pTxFrame = Frame + 1;
+	cTxLeft = Length - 1;
+	bTxDone = false;
 	CCTL0 = CCIS0 + OUTMOD0 + CCIE; //invert
-	TXByte |= 0x100;			// Add stop bit to TXByte (which is logical 1)
-	TXByte = TXByte << 1;		// Add start bit (which is logical 0)
+	TXByte = ((unsigned char)Frame[0] | 0x100) << 1;	// Add stop bit (logical 1) and start bit (logical 0)
 	cBit = 0xA;					// Load Bit counter, 8 bits + ST/SP
 	CCTL0 &= ~OUT;				// TXD Idle as Mark (invert)
 	TACTL = TASSEL_2 + MC_2;	// SMCLK, continuous mode
 	CCR0 = TAR;					// Initialize compare register
-	CCR0 += Bit_time;			// Set time till first bit
+	CCR0 += uiBitTime;			// Set time till first bit
 	CCTL0 =  CCIS0 + OUTMOD0 + OUTMOD2 + CCIE; 	// Reset signal, initial value, enable interrupts (inverted)
-	while ( CCTL0 & CCIE && i++ < 26000); 	// Wait for previous TX completion
 }
 
 void Single_Measure(unsigned int chan, unsigned char Reference)
@@ -417,79 +1742,200 @@ void Single_Measure(unsigned int chan, unsigned char Reference)
 	ADC10CTL0 |= ENC + ADC10SC;             	// Enable and start conversion
 }
 
-void Average_Measure(unsigned int chan, unsigned char Reference)
-{
-	unsigned int ADCSum;			// Accumulator and result for ADC averaging
-	unsigned int i;
-	unsigned char x;
-	ADCSum = 0;
+void ADCStart(unsigned int Ctl1, unsigned char Reference, unsigned char Transfers)
+{	// Configure ADC10 for DTC transfers into ADCBlock[] and let the sensors (P1.7) and Ref settle
 	/*Reference: 	3 = 3.3V (VCC)
 	 * 				2 = 2.5V
 	 * 				1 = 1.5V	*/
 	ADC10CTL0 &= ~ENC;				// Disable ADC
 	if(Reference == 3)
-		ADC10CTL0 = SREF_0 + ADC10SHT_3 + ADC10ON;
+		ADC10CTL0 = SREF_0 + ADC10SHT_3 + ADC10ON + MSC + ADC10IE;
 	if(Reference == 2)
-		ADC10CTL0 = SREF_1 + ADC10SHT_3 + ADC10ON + REFON + REF2_5V;
+		ADC10CTL0 = SREF_1 + ADC10SHT_3 + ADC10ON + MSC + ADC10IE + REFON + REF2_5V;
 	if(Reference == 1)
-		ADC10CTL0 = SREF_1 + ADC10SHT_3 + ADC10ON + REFON;
-	ADC10CTL1 = ADC10SSEL_3 + chan;				// Set 'chan', SMCLK
-	if(Reference < 3)
-		__delay_cycles (30000);					// Delay to allow Ref to settle
-	for(x=1;x<=16;x++){
-		ADC10CTL0 &= ~ENC;				// Disable ADC
-		ADCDone = false;
-		ADC10CTL0 &= ~ADC10IFG;
-//		ADC10CTL0 |= ADC10IE;
-		ADC10CTL0 |= ENC + ADC10SC;             	// Enable and start conversion
-		i=0;
-		while(i != 254){
-			if((ADC10CTL0 & ADC10IFG)== ADC10IFG){
-				ADCSum = ADCSum + ADC10MEM;
-				__delay_cycles (512);
-				i=253;
-			}
-			i++;
-			__delay_cycles (8);
+		ADC10CTL0 = SREF_1 + ADC10SHT_3 + ADC10ON + MSC + ADC10IE + REFON;
+	ADC10CTL1 = ADC10SSEL_3 + ADC10DIV_2 + Ctl1;	// SMCLK/3 (ADC10CLK must stay below 6.3MHz), channel and sequence mode from Ctl1
+	ADC10DTC0 = 0;					// One block per start
+	ADC10DTC1 = Transfers;			// Transfers per block
+	__delay_cycles (ADC_SETTLE);	// Delay to allow the sensors and Ref to settle
+}
+
+void ADCConvertBlock(void)
+{	// Fill ADCBlock[] once, sleeping until ADC10_ISR reports the DTC block complete
+	ADCDone = false;
+	ADC10SA = HAL_ADDRESS(ADCBlock);		// Arms the DTC
+	ADC10CTL0 |= ENC + ADC10SC;             	// Enable and start conversions
+	__disable_interrupt();
+	while(!ADCDone){
+		__bis_SR_register(LPM0_bits + GIE);
+		__disable_interrupt();
+	}
+	__enable_interrupt();
+	ADC10CTL0 &= ~ENC;				// Stop the conversions
+}
+
+void TransmitADCResult(unsigned long ADCSum)
+{	// ADCSum holds ADCSamples() conversions of one channel
+	// 16 << 2n samples: the plain average shifts by 4 + 2n, decimation keeps 2 + n extra bits and shifts by 2 + n
+	unsigned char x;
+	if(bDecimate)
+		x = 2 + ucOversample;
+	else
+		x = 4 + (ucOversample << 1);
+	TransmitValue(ADCSum >> x);
+}
+
+unsigned int ADCSamples(void)
+{	// Conversions per channel for the selected oversampling: 16, 64 or 256
+	return ADC_BLOCK << (ucOversample << 1);
+}
+
+void Average_Measure(unsigned int chan, unsigned char Reference)
+{	// The DTC fills ADCBlock[] from repeated conversions of 'chan', 16 samples per block and 1, 4 or 16 blocks (ucOversample)
+	unsigned long ADCSum;			// Accumulator and result for ADC averaging
+	unsigned int blocks;
+	unsigned char x;
+	ADCSum = 0;
+	ADCStart(CONSEQ_2 + chan, Reference, ADC_BLOCK);	// Repeat single channel
+	blocks = ADCSamples() / ADC_BLOCK;
+	while(blocks--){
+		ADCConvertBlock();
+		for(x=0;x<ADC_BLOCK;x++)
+			ADCSum += ADCBlock[x];
+	}
+	TransmitADCResult(ADCSum);
+}
+
+void Scan_Measure(char *Channels, unsigned char Count, unsigned char Reference)
+{	// Convert every channel in Channels[] (V, T, 3-7) once per sequence and reply with their averages separated by ','
+	// The sequence runs from the highest requested input down to A0, the DTC stores it in that order
+	// Channels[] (in CmdBuf) is overwritten with the ADCBlock[] index of each input
+	// The sums are split in 16 bit words and their carries (256 samples need 18 bits), the deepest frame on the stack
+	unsigned int ADCSum[ADC_SCAN_MAX];
+	unsigned char ADCCarry[ADC_SCAN_MAX];
+	unsigned char top = 0;
+	unsigned char x;
+	unsigned int n;
+	for(x=0;x<Count;x++){
+		ADCSum[x] = 0;
+		ADCCarry[x] = 0;
+		Channels[x] = Channels[x] == 'V' ? 11 : Channels[x] == 'T' ? 10 : Channels[x] - '0';
+		if(Channels[x] > top)
+			top = Channels[x];
+	}
+	for(x=0;x<Count;x++)
+		Channels[x] = top - Channels[x];
+	ADCStart(CONSEQ_1 + ((unsigned int)top << 12), Reference, top + 1);	// Sequence of channels, INCH_x = top
+	for(n=ADCSamples();n>0;n--){
+		ADCConvertBlock();
+		for(x=0;x<Count;x++){
+			ADCSum[x] += ADCBlock[(unsigned char)Channels[x]];
+			if(ADCSum[x] < ADCBlock[(unsigned char)Channels[x]])
+				ADCCarry[x]++;
 		}
 	}
-	TransmitDecimal(ADCSum >> 4);
+	for(x=0;x<Count;x++){
+		if(x > 0)
+			TransmitSeparator(',');
+		if(!bBinary && cSend > SEND_LEN - 8)
+			SendToController();		// Make room, the reply may be longer than SendBuf (a binary reply always fits)
+		TransmitADCResult(((unsigned long)ADCCarry[x] << 16) + ADCSum[x]);
+	}
 }
 
-unsigned long ConvertAdvCmdParameterFloatToHex(char CmdBufOffset, char MultipleOfTen){
-	//parameter is between CmdBuf[5] and cCmd index
-	unsigned char d = 0;
-	unsigned long l = 0;
-	unsigned long m = 0;
-	unsigned char arrN[15];
-	unsigned char n = 0;
+void StartADCStream(unsigned int chan, unsigned char Reference, unsigned long Period)
+{	// Sample 'chan' every Period SMCLK ticks until StopADCStream()
+	ADCStart(CONSEQ_2 + SHS_3 + chan, Reference, ADC_STREAM_BLOCK);	// Repeat single channel, triggered by Timer0_A OUT2
+	ADC10CTL0 &= ~MSC;				// One conversion per trigger
+	ADC10DTC0 = ADC10TB + ADC10CT;	// Two blocks, continuous
+	ucAdcReady = 0;
+	ucAdcDropped = 0;
+	ucAdcSeq = 0;
+	ucAdcChunks = (Period >> 16) + 1;
+	uiAdcChunk = Period / ucAdcChunks;
+	uiAdcChunkExtra = Period - (unsigned long)uiAdcChunk * ucAdcChunks;
+	ucAdcChunkLeft = ucAdcChunks;
+	bAdcStreaming = true;
+	ADC10SA = HAL_ADDRESS(ADCBlock);	// Arms the DTC
+	ADC10CTL0 |= ENC;
+	TACTL = TASSEL_2 + MC_2;		// SMCLK, continuous mode
+	CCR2 = TAR + uiAdcChunk + uiAdcChunkExtra;
+	CCTL2 = (ucAdcChunks == 1 ? OUTMOD_1 : OUTMOD_0) + CCIE;	// OUT2 is set by the compare that ends the period
+}
+
+void StopADCStream(void)
+{
+	CCTL2 = 0;						// OUT2 low, no more triggers
+	ADC10CTL0 &= ~ENC;
+	while (ADC10CTL1 & ADC10BUSY)	// The conversion under way completes
+		HAL_IDLE();
+	ADC10DTC0 = 0;
+	bAdcStreaming = false;
+	ucAdcReady = 0;
+	TACTL = TASSEL_2;				// SMCLK, timer off (for power consumption)
+}
+
+void SendADCBlock(void)
+{	// Send one completed half of ADCBlock[] to the controller as a binary frame
+	unsigned int Block[ADC_STREAM_BLOCK];
+	unsigned char x;
+	unsigned char b;
+	unsigned char dropped;
+	unsigned char sum;
+	__disable_interrupt();			// Snapshot, the DTC overwrites the half again ADC_STREAM_BLOCK samples later
+	b = (ucAdcReady & 1) ? 0 : ADC_STREAM_BLOCK;
+	for (x=0;x<ADC_STREAM_BLOCK;x++)
+		Block[x] = ADCBlock[b + x];
+	ucAdcReady &= b ? ~2 : ~1;
+	dropped = ucAdcDropped;
+	ucAdcDropped = 0;
+	__enable_interrupt();
+	sum = ADC_STREAM_SYNC + ucAdcSeq + dropped + ADC_STREAM_BLOCK;
+	UartPut(ADC_STREAM_SYNC);
+	UartPut(ucAdcSeq++);
+	UartPut(dropped);
+	UartPut(ADC_STREAM_BLOCK);
+	for (x=0;x<ADC_STREAM_BLOCK;x++){
+		UartPut(Block[x]);
+		UartPut(Block[x] >> 8);
+		sum += (unsigned char)Block[x] + (unsigned char)(Block[x] >> 8);
+	}
+	UartPut(sum);
+}
 
-	signed char i=4;
-	i += CmdBufOffset;
-	while(i<cCmd && (m<MultipleOfTen || MultipleOfTen==0)){
-		if (CmdBuf[i] == '.'){
-			d = i++;
+signed char ParseNumber(unsigned char i, unsigned char Decimals, unsigned long Max, unsigned long *Value)
+{	// Fixed-point parameter at CmdBuf[i]: digits with an optional '.' and fraction, scaled by 10^Decimals (further fraction digits are dropped)
+	// Returns the index of the first character after it, -1 when there is no digit or the value is above Max (at most 0x19999999)
+	unsigned long l = 0;
+	signed char Frac = -1;			// Fraction digits taken, -1 before the '.'
+	bool bDigit = false;
+	for(;i<cCmd;i++){
+		if(CmdBuf[i] == '.' && Frac < 0){
+			Frac = 0;
+		}else if(CmdBuf[i] >= '0' && CmdBuf[i] <= '9'){
+			bDigit = true;
+			if(Frac >= (signed char)Decimals)
+				continue;
+			if(Frac >= 0)
+				Frac++;
+			l = l*10 + CmdBuf[i] - '0';
+			if(l > Max)
+				return -1;
 		}else{
-			if (d > 0){
-				arrN[n++] = CmdBuf[i++]-'0';
-				m++;
-			}else if (d == 0){
-				arrN[n++] = CmdBuf[i++]-'0';
-			}
+			break;
 		}
 	}
-	//pad zeros
-	while (m<MultipleOfTen){
-		arrN[n++] = 0;
-		m++;
-	}
-	l = arrN[n-1];
-	m=1;
-	for (i=n-2;i>=0;i--){
-		l += arrN[i] * 10 * m;
-		m *= 10;
+	if(!bDigit)
+		return -1;
+	if(Frac < 0)
+		Frac = 0;
+	for(;Frac<(signed char)Decimals;Frac++){
+		l *= 10;
+		if(l > Max)
+			return -1;
 	}
-	return l;
+	*Value = l;
+	return i;
 }
 
 //Convert TXByte to unsigned integer in ASCII and add result to SendBuf
@@ -537,6 +1983,38 @@ void TransmitDecimal(unsigned int TXByte)
     SendBuf[++cSend]=d0 + '0';
 }
 
+void TransmitValue(unsigned int Value)
+{	// Add a 16 bit value to SendBuf, decimal or little endian in binary mode
+	if(bBinary){
+		SendBuf[++cSend] = Value;
+		SendBuf[++cSend] = Value >> 8;
+	}else{
+		TransmitDecimal(Value);
+	}
+}
+
+void TransmitLongValue(unsigned long Value)
+{	// Add a 32 bit value to SendBuf, decimal (up to 999999) or little endian in binary mode
+	if(bBinary){
+		TransmitValue(Value);
+		TransmitValue(Value >> 16);
+	}else{
+		TransmitExtendedDecimal((Value >> 16) & 0x00FF, Value, 0);
+	}
+}
+
+void TransmitSeparator(char c)
+{	// Separators between ASCII values, binary values have a fixed width
+	if(!bBinary)
+		SendBuf[++cSend] = c;
+}
+
+void SendText(const char *Text){
+	//Add a string to SendBuf
+	while(*Text)
+		SendBuf[++cSend] = *Text++;
+}
+
 void SendOKNO(bool PF){
 	//Pass = true, Fail = false
 	if(PF){
@@ -622,98 +2100,188 @@ void TransmitExtendedDecimal(unsigned char Extend, unsigned int TXByte, char Dec
     SendBuf[++cSend]=d0 + '0';									//Ones
 }
 
-bool ProgramFlashInfoSegment(char *ptrDestSeg,char *ptrDestAddr,char *ptrSource,char NumItems){
-	//The NumItems of the array ptrSource will be written starting at ptrDestAddr in the segment ptrDestSeg
-		//ptrSource points to an array of length NumItems
-		//ptrDestSeg is the address of the information segment to be written to
-		//ptrDestAddr is the starting address in the ptrDestSeg segment where the ptrSource array will be written to
-	char arrSeg[64];
-	char i;
-	char n;
-	char *d;
-	bool pf = true;
+void ConfigInit(void)
+{	// Find the segments of the configuration store and index their records, oldest segment first
+	unsigned char Order[CFG_SEGMENTS];
+	unsigned char n = 0;
+	unsigned char k;
+	unsigned char j;
+	char *p;
+	for (k=0;k<CFG_KEYS;k++)
+		CfgIndex[k] = CFG_UNSET;
+	for (k=0;k<CFG_SEGMENTS;k++){
+		if (*CfgSegment(k) != (char)CFG_MAGIC || CfgScan(k, false) < 0)
+			continue;
+		for (j=n;j>0 && (signed char)(CfgSegment(Order[j-1])[1] - CfgSegment(k)[1]) > 0;j--)
+			Order[j] = Order[j-1];
+		Order[j] = k;
+		n++;
+	}
+	if (n == 0){
+		ConfigMigrate();
+		return;
+	}
+	for (k=0;k<n;k++)
+		ucCfgFree = CfgScan(Order[k], true);
+	ucCfgHead = Order[n-1];
+	p = CfgSegment(ucCfgHead);
+	for (k=ucCfgFree;k<CFG_SEG_SIZE;k++)
+		if (p[k] != (char)0xFF)
+			ucCfgFree = CFG_SEG_SIZE;	// A record was cut short, continue in the next segment
+	if (n == CFG_SEGMENTS && !CfgCompact())	// A compaction was cut short, finish it
+		ConfigInit();				// or index the two segments left if it fails again
+}
 
-	IE1 &= ~WDTIE;
+void ConfigMigrate(void)
+{	// Start the store in segment D, segments C and B are erased when the log first rolls into them
+	// The baseline firmware kept only its Read Delay there, as a count of busy-wait loop iterations rather than
+	// microseconds, so it is not carried over and main() writes the 100000us default instead
+	CfgOpen(0, 0);
+}
 
-	// Copy Destination Segment to Ram
-	d = ptrDestSeg;
-	for (i=0;i<64;i++){
-		arrSeg[i] = *d++;
+bool ConfigWrite(unsigned char Key, const char *Data, unsigned char Len)
+{	// Store Len bytes of Data as the value of Key, the same length every time
+	unsigned char n;
+	if (memcmp(CfgValue(Key), Data, Len) == 0)
+		return true;				// Unchanged, spare the flash
+	for (n=0;n<CFG_SEGMENTS;n++){
+		if (CfgAppend(Key, Data, Len))
+			return true;
+		CfgRoll();
 	}
-	// Handle LOCKA for Information Segment A
-//	if(ptrDestSeg == Flash_ptrA){
-//		if((FCTL3 & LOCKA) == LOCKA){
-//			FCTL3 = FWKEY + LOCKA;
-//		}
-//	}
-	// Erase Segment
-	FCTL1 = FWKEY + ERASE;                    // Set Erase bit
-	FCTL2 = FWKEY + FSSEL_2 + FN0 + FN1 + FN2 + FN3 + FN4 + FN5; // set for 16Mhz
-	FCTL3 = FWKEY;                            // Clear Lock bit
-	*ptrDestSeg = 0;                           // Dummy write to erase Flash segment
+	return false;
+}
 
-	FCTL1 = FWKEY + WRT;                      // Set WRT bit for write operation
+signed char CfgScan(unsigned char Seg, bool bIndex)
+{	// Walk the records of a segment, returns the offset of its free space or -1 if it is not a valid log segment
+	// bIndex points CfgIndex[] at its records
+	char *p = CfgSegment(Seg);
+	unsigned char Off = 2;
+	unsigned char Key;
+	unsigned char Len;
+	while (Off < CFG_SEG_SIZE && p[Off] != (char)0xFF){
+		Key = p[Off];
+		Len = p[Off+1];
+		if (Key >= CFG_KEYS || Off + 2 + Len > CFG_SEG_SIZE)
+			return -1;
+		if (bIndex)
+			CfgIndex[Key] = (Seg << 6) + Off + 2;
+		Off += (Len + 3) & ~1;
+	}
+	return Off;
+}
 
-	// Write Ram back to Destination Segment, but use Source data for NumItems when DestSeg matches DestAddr
-	d = ptrDestSeg;
-	n=0;
-	for (i=0;i<64;i++){
-		if (d >= ptrDestAddr && n < NumItems){
-			*d++ = *(ptrSource + n++);
-		}else{
-			*d++ = arrSeg[i];
-		}
+bool CfgAppend(unsigned char Key, const char *Data, unsigned char Len)
+{	// Program a record into the free space of the head segment, the header goes last and makes it valid
+	char *p = CfgSegment(ucCfgHead) + ucCfgFree;
+	char w[2];
+	bool pf = true;
+	if (ucCfgFree + ((Len + 3) & ~1) > CFG_SEG_SIZE)
+		return false;
+	if (Len > 1)
+		pf = FlashWrite(p + 2, Data, Len & ~1);
+	if (Len & 1){
+		w[0] = Data[Len-1];
+		w[1] = 0xFF;
+		pf &= FlashWrite(p + 1 + Len, w, 2);
 	}
+	w[0] = Key;
+	w[1] = Len;
+	pf &= FlashWrite(p, w, 2);
+	if (pf)
+		CfgIndex[Key] = (ucCfgHead << 6) + ucCfgFree + 2;
+	ucCfgFree += (Len + 3) & ~1;
+	return pf;
+}
 
-	FCTL1 = FWKEY;                            // Clear WRT bit
-	FCTL3 = FWKEY + LOCK;                     // Set LOCK bit
+void CfgOpen(unsigned char Seg, unsigned char Seq)
+{	// Erase Seg and make it the head of the log
+	char w[2];
+	FlashErase(CfgSegment(Seg));
+	w[0] = CFG_MAGIC;
+	w[1] = Seq;
+	FlashWrite(CfgSegment(Seg), w, 2);
+	ucCfgHead = Seg;
+	ucCfgFree = 2;
+}
 
-// Verify data
-	d = ptrDestSeg;
-	n=0;
-	for (i=0;i<64;i++){
-		if (d >= ptrDestAddr && n < NumItems){
-			if(*d++ != *(ptrSource + n++))
-				pf = false;
-		}else{
-			if(*d++ != arrSeg[i])
-				pf = false;
+void CfgRoll(void)
+{	// Continue the log in an erased segment, and compact the oldest if none is left over
+	unsigned char k;
+	unsigned char Seq = CfgSegment(ucCfgHead)[1] + 1;
+	for (k=0;k<CFG_SEGMENTS && *CfgSegment(k) == (char)CFG_MAGIC;k++);
+	if (k == CFG_SEGMENTS)
+		return;						// Does not happen, CfgCompact() always leaves one
+	CfgOpen(k, Seq);
+	for (k=0;k<CFG_SEGMENTS && *CfgSegment(k) == (char)CFG_MAGIC;k++);
+	if (k == CFG_SEGMENTS && !CfgCompact())
+		ConfigInit();				// Index the two segments left
+}
+
+bool CfgCompact(void)
+{	// Copy the live records of the oldest segment to the head and erase it, once every copy has read back right
+	// The head holds nothing but these copies while all segments are in use, so if one fails the head is erased
+	// instead and the oldest segment stays live, CfgRoll() starts over in it the next time. Returns false then,
+	// CfgIndex[] must be built again
+	unsigned char k;
+	unsigned char Oldest = ucCfgHead;
+	char *p;
+	for (k=0;k<CFG_SEGMENTS;k++)
+		if (*CfgSegment(k) == (char)CFG_MAGIC
+				&& (signed char)(CfgSegment(Oldest)[1] - CfgSegment(k)[1]) > 0)
+			Oldest = k;
+	if (Oldest == ucCfgHead)
+		return true;
+	for (k=0;k<CFG_KEYS;k++)
+		if ((CfgIndex[k] >> 6) == Oldest){	// Never true for CFG_UNSET
+			p = INFO_FLASH_BASE + CfgIndex[k];	// Data of the record, its length is the byte in front
+			if (!CfgAppend(k, p, p[-1])){
+				FlashErase(CfgSegment(ucCfgHead));
+				return false;
+			}
 		}
-	}
+	FlashErase(CfgSegment(Oldest));
+	return true;
+}
 
-	IE1 |= WDTIE;
-	return pf;
+void FlashErase(char *Segment)
+{	// Erase one 64 byte information segment, the CPU stalls until it is done
+	FCTL2 = FWKEY + FSSEL_2 + FN0 + FN1 + FN2 + FN3 + FN4 + FN5; // set for 16Mhz
+	FCTL1 = FWKEY + ERASE;                    // Set Erase bit
+	FCTL3 = FWKEY;                            // Clear Lock bit
+	HAL_FLASH_ERASE(Segment);                 // Dummy write to erase Flash segment
+	FCTL1 = FWKEY;                            // Clear Erase bit
+	FCTL3 = FWKEY + LOCK;                     // Set LOCK bit
 }
 
-#pragma vector=ADC10_VECTOR
-__interrupt void ADC10_ISR (void)
-{
-	ADCValue = ADC10MEM;			// Saves measured value.
-	ADCDone = true;  			// Sets flag for main loop.
-//	__bic_SR_register_on_exit(CPUOFF);	// Enable CPU so the main while loop continues
+bool FlashWrite(char *Dest, const char *Source, unsigned char Length)
+{	// Program Length (even) bytes of Source to the erased flash at the even address Dest a word at a time
+	// Returns false if the flash does not read back the data
+	unsigned char i;
+	FCTL2 = FWKEY + FSSEL_2 + FN0 + FN1 + FN2 + FN3 + FN4 + FN5; // set for 16Mhz
+	FCTL3 = FWKEY;                            // Clear Lock bit
+	FCTL1 = FWKEY + WRT;                      // Set WRT bit for write operation
+	for (i=0;i<Length;i+=2)
+		HAL_FLASH_WRITE(Dest + i, (unsigned char)Source[i] | ((unsigned int)(unsigned char)Source[i+1] << 8));
+	FCTL1 = FWKEY;                            // Clear WRT bit
+	FCTL3 = FWKEY + LOCK;                     // Set LOCK bit
+	return memcmp(Dest, Source, Length) == 0;
 }
 
-#pragma vector=PORT1_VECTOR
-__interrupt void Port_1(void)
+#pragma vector=ADC10_VECTOR
+__interrupt void ADC10_ISR (void)
 {
-	if (bStopbit){  // Capture rising edge of stop bit, save RX Byte and prepare to capture falling edge of the next start bit
-		SendBuf[++cSend] = RXByte;
-		CCTL0 &= ~ CCIE ;		// Disable interrupt
-		bStopbit = false;
-		P1IES &= ~RXD;				// RXD Lo/Hi edge interrupt, INVERT to handle serf inverted drive
-		P1IFG &= ~RXD;			// clear RXD IFG (interrupt flag)
-		P1IE |= RXD;			// enabled RXD interrupt
-	}
-	else{
-		CCR0 = TAR;			// Initialize compare register
-		CCR0 += Bit_time_RX_Initial;		// Set time till first bit (adjusted for processing delay)
-		P2OUT |= BIT1; //debug
-		bRXBit = true;
-		P1IE &= ~RXD;			// Disable RXD interrupt
-		CCTL0 = OUTMOD_2 + CCIE;		// Disable TX and enable interrupts
-		cBit = 0x7;			// Load Bit counter, 8 bits
-		bStopbit = false;
+	if (bAdcStreaming){				// A half of ADCBlock[] is full, B1 tells which
+		unsigned char b = (ADC10DTC0 & ADC10B1) ? 1 : 2;
+		if (ucAdcReady & b)
+			ucAdcDropped++;			// main() did not get to send it in time
+		ucAdcReady |= b;
+		ucEvents |= EV_ADC;
+		__bic_SR_register_on_exit(CPUOFF);
+		return;
 	}
+	ADCDone = true;  			// Sets flag for main loop.
+	__bic_SR_register_on_exit(CPUOFF);	// Enable CPU so the main while loop continues
 }
 
 //#pragma vector=PORT2_VECTOR
@@ -725,59 +2293,181 @@ __interrupt void Port_1(void)
 #pragma vector=TIMER0_A0_VECTOR
 __interrupt void TIMER0_A0_ISR (void)
 {
+	bool bMark;					// Majority of the samples of a received bit
 	if(!bRXBit)
 	{
-		if ( cBit == 0)			// If all bits TXed
-		{
-			CCTL0 &= ~CCIE ;		// Disable interrupt
-		}
-		else
+		if ( cBit == 0)			// The stop bit has just started
 		{
-			CCR0 += Bit_time;			// Add Offset to CCR0
-			CCTL0 &=  ~OUTMOD2;		// Set TX bit to 1 (inverted)
-			if (TXByte & 0x01)
-				CCTL0 |= OUTMOD2;		// if it should be 1, set it to 0 (inverted)
-			TXByte = TXByte >> 1;
-			cBit --;
+			if (cTxLeft < 0)		// and the last one has lasted a bit time
+			{
+				CCTL0 &= ~CCIE ;		// Disable interrupt
+				bTxDone = true;
+				__bic_SR_register_on_exit(LPM0_bits);	// Wake BusTransaction()
+				return;
+			}
+			if (cTxLeft-- == 0)
+			{
+				TXByte = 0x01;		// Hold the stop bit (mark) for one more bit time
+				cBit = 1;
+			}
+			else
+			{
+				TXByte = ((unsigned char)*pTxFrame++ | 0x100) << 1;	// Next byte with its start and stop bit
+				cBit = 0xA;
+			}
 		}
+		CCR0 += uiBitTime;			// Add Offset to CCR0
+		CCTL0 &=  ~OUTMOD2;		// Set TX bit to 1 (inverted)
+		if (TXByte & 0x01)
+			CCTL0 |= OUTMOD2;		// if it should be 1, set it to 0 (inverted)
+		TXByte = TXByte >> 1;
+		cBit --;
 	}
 	else
 	{
-		if ( cBit == 0)
+		if (CACTL2 & CAOUT)		// Mark
+			ucRxVotes++;
+		if (--ucRxPhase)
+		{
+			CCR0 += uiRxGap;		// Next sample of the same bit
+			return;
+		}
+		CCR0 += uiRxNext;			// First sample of the next bit
+		bMark = ucRxVotes > (ucRxSamples >> 1);
+		if (ucRxVotes != 0 && ucRxVotes != ucRxSamples)
+			ucRxFlags |= RX_NOISE;
+		ucRxVotes = 0;
+		ucRxPhase = ucRxSamples;
+		if (cBit == 9)				// Start bit
+		{
+			if (bMark)				// A glitch, not a start bit
+			{
+				CCTL0 &= ~CCIE;			// Disable interrupt
+				CCTL1 = RX_CAPTURE + CCIE;	// Wait for the next edge
+				return;
+			}
+		}
+		else if (cBit == 0)			// Stop bit, the byte is complete
 		{
-			if ( (P1IN & RXD) == 0)	// If bit is clear?, INVERT to handle serf inverted drive
-				RXByte |= 0x80;		// Set the value in the RXByte
-			bStopbit = true;			// Capture Rising Edge of Stop Bit
-			P1IES |= RXD;				// RXD Hi/Lo edge interrupt, INVERT to handle serf inverted drive
-			P1IFG &= ~RXD;			// clear RXD IFG (interrupt flag)
-			P1IE |= RXD;			// enabled RXD interrupt
+			CCTL0 &= ~CCIE;			// Disable interrupt
+			if (!bMark)
+				ucRxFlags |= RX_FRAMING;
+			CCTL1 = RX_CAPTURE + CCIE;	// Ready for the next start bit, its edge is latched even if ReceiveByte() takes a while
+			if (ReceiveByte(RXByte, ucRxFlags))
+				__bic_SR_register_on_exit(LPM0_bits);	// Wake main() to process the reply
+			return;
 		}
 		else
 		{
-			CCR0 += Bit_time_RX;			// Add Offset to CCR0
-			if ( (P1IN & RXD) == 0)	// If bit is set?, INVERT to handle serf inverted drive
-				RXByte |= 0x80;		// Set the value in the RXByte
-			RXByte = RXByte >> 1;		// Shift the bits down
-			cBit --;
+			RXByte = RXByte >> 1;		// LSB first
+			if (bMark)
+				RXByte |= 0x80;
+		}
+		cBit --;
+	}
+}
+
+#pragma vector=TIMER0_A1_VECTOR
+__interrupt void TIMER0_A1_ISR(void)
+{
+	switch(__even_in_range(TA0IV, 10)){
+	case TA0IV_TACCR1:				// Leading edge of a start bit, TIMER0_A0_ISR samples the byte from the captured time
+		CCR0 = CCR1 + uiRxFirst;	// First sample of the start bit, exact whatever the interrupt latency
+		bRXBit = true;
+		CCTL1 = RX_CAPTURE;			// No interrupts until the stop bit has been sampled
+		CCTL0 = OUTMOD_2 + CCIE;	// Disable TX and enable interrupts
+		cBit = 9;					// Start bit, 8 data bits, stop bit
+		RXByte = 0;
+		ucRxFlags = 0;
+		ucRxVotes = 0;
+		ucRxPhase = ucRxSamples;
+		break;
+	case TA0IV_TACCR2:				// AD stream sample clock
+		if (--ucAdcChunkLeft == 0){	// OUT2 has just been set and triggered a sample
+			CCTL2 = OUTMOD_0 + CCIE;	// OUT2 low again
+			ucAdcChunkLeft = ucAdcChunks;
+			CCR2 += uiAdcChunk + uiAdcChunkExtra;
+		}else{
+			CCR2 += uiAdcChunk;
 		}
+		if (ucAdcChunkLeft == 1)
+			CCTL2 = OUTMOD_1 + CCIE;	// Set OUT2 on the next compare
+		break;
+	}
+}
+
+#pragma vector=TIMER1_A1_VECTOR
+__interrupt void TIMER1_A1_ISR(void)
+{
+	switch(__even_in_range(TA1IV, 10)){
+	case TA1IV_TACCR1:				// Response timeout
+		if (uiTimeoutWraps){
+			uiTimeoutWraps--;		// CCR1 matches again after one more full period
+		}else{
+			TA1CCTL1 &= ~CCIE;
+			bTimeout = true;
+			__bic_SR_register_on_exit(LPM0_bits);	// Wake main()
+		}
+		break;
+	case TA1IV_TAIFG:				// Time base overflow
+		uiTimerHigh++;
+		ucEvents |= EV_TICK;
+		__bic_SR_register_on_exit(LPM0_bits);	// Wake main() to check its deadlines
+		break;
 	}
 }
 
 #pragma vector=USCIAB0RX_VECTOR
 __interrupt void USCI0RX_ISR(void)
 {
-	CmdBuf[++cCmd] = UCA0RXBUF;
-	if (CmdBuf[cCmd] == 0x0D)
-		IE2 &= ~UCA0RXIE;
-	//Check for overflow and reset Cmd Buffer and counter
-	if (cCmd == 30){
-		cCmd = -1;
-		IE2 |= UCA0RXIE;
+	unsigned char n;
+	if (UCA0STAT & UCFE){		// Read before UCA0RXBUF, which clears the error flags
+		if (++ucUartErrors >= UART_ERROR_LIMIT){
+			ucEvents |= EV_UART;
+			__bic_SR_register_on_exit(LPM0_bits);	// Wake main()
+		}
+	}
+	char c = UCA0RXBUF;
+	if (cRx == -1 && ucCmdReady == CMD_SLOTS)
+		cRx = CMD_DROPPING;				// No slot for this command
+	if (cRx == CMD_DROPPING){
+		if (c == 0x0D){
+			cRx = -1;
+			n = (ucRxSlot ? ucRxSlot : CMD_SLOTS) - 1;	// Answered after the newest queued command
+			if (CmdDropped[n] < 255)
+				CmdDropped[n]++;
+		}
+		return;
+	}
+	CmdQueue[ucRxSlot][++cRx] = c;
+	if (c == 0x0D){
+		CmdStamp[ucRxSlot] = GetTicks();	// Hand the command to main() and continue in the next slot
+		ucEvents |= EV_COMMAND;
+		__bic_SR_register_on_exit(LPM0_bits);	// Wake main()
+		cRx = -1;
+		if (++ucRxSlot == CMD_SLOTS)
+			ucRxSlot = 0;
+		ucCmdReady++;
+	}else if (cRx == CMD_LEN - 1){
+		cRx = -1;						//Check for overflow and reset Cmd Buffer and counter
+	}
+}
+
+#pragma vector=USCIAB0TX_VECTOR
+__interrupt void USCI0TX_ISR(void)
+{
+	if (ucTxTail != ucTxHead){
+		if (((ucTxHead + 1) & (TX_RING_SIZE - 1)) == ucTxTail)
+			__bic_SR_register_on_exit(LPM0_bits);	// The ring was full, wake UartPut()
+		UCA0TXBUF = TxRing[ucTxTail];
+		ucTxTail = (ucTxTail + 1) & (TX_RING_SIZE - 1);
 	}
+	if (ucTxTail == ucTxHead)
+		IE2 &= ~UCA0TXIE;		// Ring empty, UartPut() re-enables the interrupt
 }
 
 /* Initialize non-used ISR vectors with a trap function */
-#pragma vector=NMI_VECTOR,USCIAB0TX_VECTOR
+#pragma vector=NMI_VECTOR
 __interrupt void ISR_trap(void)
 {
   // the following will cause an access violation which results in a PUC reset
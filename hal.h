@@ -0,0 +1,85 @@
+/*
+* * *
+The MIT License (MIT)
+
+Copyright (c) <2014> <Nathan A. Wehr>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+* * *
+
+Hardware abstraction for the Samewire master
+
+On the MSP430G2553 this is a thin wrapper around msp430g2553.h and the compiler intrinsics.
+
+Defining SAMEWIRE_HOST builds the firmware for a host port instead, such as the simulator in host/.
+The port supplies its own msp430g2553.h in which the peripheral registers are plain 16-bit/8-bit
+variables, the image of the information flash, and the hal_ functions declared below.
+The port then calls samewire_main() and raises the interrupt handlers (TIMER0_A1_ISR, TIMER0_A0_ISR,
+USCI0RX_ISR, ...) itself as its simulated clock, bus and serfs advance.
+
+*/
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include "msp430g2553.h"
+
+#ifdef SAMEWIRE_HOST
+
+extern char hal_info_flash[256];				// Information memory image, 0x1000 - 0x10FF
+
+void hal_delay_cycles(unsigned long cycles);	// Advance the simulated clock
+void hal_bis_sr(unsigned int bits);				// GIE / low power mode bits set in main()
+void hal_bic_sr_on_exit(unsigned int bits);		// Low power mode bits cleared by an ISR
+void hal_idle(void);							// Called from every busy wait, the port may raise pending interrupts here
+unsigned int hal_get_sr(void);					// Current GIE / low power mode bits
+void hal_disable_interrupt(void);
+void hal_enable_interrupt(void);
+unsigned int hal_address(void *p);				// 16-bit handle for a buffer given to the DTC (ADC10SA)
+void hal_flash_erase(char *segment);			// Set the 64 bytes of an information segment to 0xFF
+void hal_flash_write(char *p, unsigned int w);	// Program the word at the even address p, bits can only be cleared
+
+#define		main							samewire_main
+#define		__interrupt
+#define		__delay_cycles(n)				hal_delay_cycles(n)
+#define		_delay_cycles(n)				hal_delay_cycles(n)
+#define		__bis_SR_register(bits)			hal_bis_sr(bits)
+#define		__bic_SR_register_on_exit(bits)	hal_bic_sr_on_exit(bits)
+#define		__get_SR_register()				hal_get_sr()
+#define		__disable_interrupt()			hal_disable_interrupt()
+#define		__enable_interrupt()			hal_enable_interrupt()
+#define		__even_in_range(x, y)			(x)
+
+#define		INFO_FLASH_BASE		(hal_info_flash)
+#define		HAL_IDLE()			hal_idle()
+#define		HAL_ADDRESS(p)		hal_address(p)
+#define		HAL_FLASH_ERASE(p)	hal_flash_erase(p)
+#define		HAL_FLASH_WRITE(p, w)	hal_flash_write(p, w)
+
+#else
+
+#define		INFO_FLASH_BASE		((char *) 0x1000)
+#define		HAL_IDLE()
+#define		HAL_ADDRESS(p)		((unsigned int)(p))
+#define		HAL_FLASH_ERASE(p)	(*(p) = 0)		// Dummy write, FCTL1 has ERASE set
+#define		HAL_FLASH_WRITE(p, w)	(*(unsigned int *)(p) = (w))	// FCTL1 has WRT set
+
+#endif
+
+#endif /* HAL_H_ */
@@ -0,0 +1,203 @@
+/*
+Host port register file for the Samewire master
+
+Stands in for the TI msp430g2553.h when the firmware is built with SAMEWIRE_HOST.  The peripheral registers
+are plain variables defined by port.c, which moves them along with its simulated clock, and the bit names
+have the values of the TI header.  Only what the firmware uses is here.
+
+*/
+
+#ifndef MSP430G2553_HOST_H_
+#define MSP430G2553_HOST_H_
+
+// X(name) lists of the 8 and 16 bit registers, port.c expands them into the definitions
+#define MSP430_REGS8(X) \
+	X(IE1) X(IFG1) X(IE2) X(IFG2) \
+	X(P1IN) X(P1OUT) X(P1DIR) X(P1IFG) X(P1IES) X(P1IE) X(P1SEL) X(P1SEL2) X(P1REN) \
+	X(P2IN) X(P2OUT) X(P2DIR) X(P2IFG) X(P2IES) X(P2IE) X(P2SEL) X(P2SEL2) \
+	X(BCSCTL1) X(BCSCTL2) X(BCSCTL3) X(DCOCTL) X(CALBC1_16MHZ) X(CALDCO_16MHZ) \
+	X(UCA0CTL0) X(UCA0CTL1) X(UCA0BR0) X(UCA0BR1) X(UCA0MCTL) X(UCA0STAT) X(UCA0RXBUF) \
+	X(ADC10DTC0) X(ADC10DTC1) X(ADC10AE0) \
+	X(CACTL1) X(CACTL2) X(CAPD)
+#define MSP430_REGS16(X) \
+	X(WDTCTL) \
+	X(UCA0TXBUF) \
+	X(TA0CTL) X(TA0R) X(TA0CCTL0) X(TA0CCTL1) X(TA0CCTL2) X(TA0CCR0) X(TA0CCR1) X(TA0CCR2) X(TA0IV) \
+	X(TA1CTL) X(TA1R) X(TA1CCTL0) X(TA1CCTL1) X(TA1CCTL2) X(TA1CCR0) X(TA1CCR1) X(TA1CCR2) X(TA1IV) \
+	X(ADC10CTL0) X(ADC10CTL1) X(ADC10MEM) X(ADC10SA) \
+	X(FCTL1) X(FCTL2) X(FCTL3)
+// UCA0TXBUF is 16 bits wide here so that port.c can tell whether USCI0TX_ISR wrote it
+
+#define MSP430_DECLARE8(r)		extern volatile unsigned char r;
+#define MSP430_DECLARE16(r)		extern volatile unsigned short r;
+MSP430_REGS8(MSP430_DECLARE8)
+MSP430_REGS16(MSP430_DECLARE16)
+
+// Timer0_A3 legacy names
+#define TACTL		TA0CTL
+#define TAR			TA0R
+#define CCTL0		TA0CCTL0
+#define CCTL1		TA0CCTL1
+#define CCTL2		TA0CCTL2
+#define CCR0		TA0CCR0
+#define CCR1		TA0CCR1
+#define CCR2		TA0CCR2
+#define TAIV		TA0IV
+
+#define BIT0	0x0001
+#define BIT1	0x0002
+#define BIT2	0x0004
+#define BIT3	0x0008
+#define BIT4	0x0010
+#define BIT5	0x0020
+#define BIT6	0x0040
+#define BIT7	0x0080
+#define BIT8	0x0100
+#define BIT9	0x0200
+#define BITA	0x0400
+#define BITB	0x0800
+#define BITC	0x1000
+#define BITD	0x2000
+#define BITE	0x4000
+#define BITF	0x8000
+
+// Status register
+#define GIE			0x0008
+#define CPUOFF		0x0010
+#define OSCOFF		0x0020
+#define SCG0		0x0040
+#define SCG1		0x0080
+#define LPM0_bits	(CPUOFF)
+#define LPM3_bits	(SCG1+SCG0+CPUOFF)
+
+// Watchdog
+#define WDTPW		0x5A00
+#define WDTHOLD		0x0080
+
+// Special function registers
+#define UCA0RXIE	0x01
+#define UCA0TXIE	0x02
+#define UCA0RXIFG	0x01
+#define UCA0TXIFG	0x02
+
+// USCI_A0 UART
+#define UCSWRST		0x01
+#define UCSSEL_2	0x80
+#define UCBRF_0		0x00
+#define UCBRS_0		0x00
+#define UCBRS_1		0x02
+#define UCBRS_2		0x04
+#define UCBRS_3		0x06
+#define UCBRS_4		0x08
+#define UCBRS_5		0x0A
+#define UCBRS_6		0x0C
+#define UCBRS_7		0x0E
+#define UCBUSY		0x01
+#define UCRXERR		0x04
+#define UCPE		0x10
+#define UCOE		0x20
+#define UCFE		0x40
+
+// Timer_A
+#define TASSEL_2	0x0200
+#define ID_0		0x0000
+#define ID_3		0x00C0
+#define MC_0		0x0000
+#define MC_1		0x0010
+#define MC_2		0x0020
+#define MC_3		0x0030
+#define TACLR		0x0004
+#define TAIE		0x0002
+#define TAIFG		0x0001
+#define CM_0		0x0000
+#define CM_1		0x4000
+#define CM_2		0x8000
+#define CM_3		0xC000
+#define CCIS_0		0x0000
+#define CCIS_1		0x1000
+#define CCIS0		0x1000
+#define CCIS1		0x2000
+#define SCS			0x0800
+#define SCCI		0x0400
+#define CAP			0x0100
+#define OUTMOD0		0x0020
+#define OUTMOD1		0x0040
+#define OUTMOD2		0x0080
+#define OUTMOD_0	0x0000
+#define OUTMOD_1	0x0020
+#define OUTMOD_2	0x0040
+#define OUTMOD_3	0x0060
+#define OUTMOD_4	0x0080
+#define OUTMOD_5	0x00A0
+#define OUTMOD_6	0x00C0
+#define OUTMOD_7	0x00E0
+#define CCIE		0x0010
+#define CCI			0x0008
+#define OUT			0x0004
+#define COV			0x0002
+#define CCIFG		0x0001
+#define TA0IV_TACCR1	0x0002
+#define TA0IV_TACCR2	0x0004
+#define TA0IV_TAIFG		0x000A
+#define TA1IV_TACCR1	0x0002
+#define TA1IV_TACCR2	0x0004
+#define TA1IV_TAIFG		0x000A
+
+// ADC10
+#define ADC10SC		0x0001
+#define ENC			0x0002
+#define ADC10IFG	0x0004
+#define ADC10IE		0x0008
+#define ADC10ON		0x0010
+#define REFON		0x0020
+#define REF2_5V		0x0040
+#define MSC			0x0080
+#define ADC10SHT_3	0x1800
+#define SREF_0		0x0000
+#define SREF_1		0x2000
+#define ADC10BUSY	0x0001
+#define CONSEQ_0	0x0000
+#define CONSEQ_1	0x0002
+#define CONSEQ_2	0x0004
+#define CONSEQ_3	0x0006
+#define ADC10SSEL_3	0x0018
+#define ADC10DIV_2	0x0040
+#define SHS_3		0x0C00
+#define INCH_10		0xA000
+#define INCH_11		0xB000
+#define ADC10TB		0x08
+#define ADC10CT		0x04
+#define ADC10B1		0x02
+
+// Flash controller
+#define FWKEY		0xA500
+#define ERASE		0x0002
+#define WRT			0x0040
+#define FSSEL_2		0x0080
+#define FN0			0x0001
+#define FN1			0x0002
+#define FN2			0x0004
+#define FN3			0x0008
+#define FN4			0x0010
+#define FN5			0x0020
+#define LOCK		0x0010
+
+// Comparator_A+
+#define CAON		0x08
+#define CAREF_2		0x20
+#define P2CA3		0x20
+#define P2CA2		0x10
+#define CAF			0x02
+#define CAOUT		0x01
+#define CAPD6		0x40
+
+// Interrupt vectors, only named by the #pragma lines the host compiler ignores
+#define ADC10_VECTOR		(5 * 2u)
+#define USCIAB0TX_VECTOR	(6 * 2u)
+#define USCIAB0RX_VECTOR	(7 * 2u)
+#define TIMER0_A1_VECTOR	(8 * 2u)
+#define TIMER0_A0_VECTOR	(9 * 2u)
+#define TIMER1_A1_VECTOR	(12 * 2u)
+#define NMI_VECTOR			(14 * 2u)
+
+#endif /* MSP430G2553_HOST_H_ */
@@ -0,0 +1,793 @@
+/*
+Host port of the Samewire master, see port.h
+
+Time only passes inside the hal_ functions (delays, low power mode, busy waits).  Each of them first
+picks up what the firmware wrote to the registers (Sync), then steps the clock from one event to the
+next: timer compares and overflows, controller UART characters, serf bit edges.  Interrupts are taken
+in the MSP430G2553 priority order whenever GIE is set.  samewire_main() runs on a context of its own,
+which hands control back to the test when the time given by sim_run() is up.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include "msp430g2553.h"
+#include "port.h"
+
+#define		NEVER			UINT64_MAX
+#define		TXD				BIT5		// Bus transmitter, a high pin pulls the bus to space
+#define		SC				31			// Samewire separating character
+#define		SERF_IDLE_US	10000		// A serf starts a new request after the bus has been idle this long
+#define		TX_SENTINEL		0x1234		// UCA0TXBUF before USCI0TX_ISR runs, a byte written by the ISR never reads back as this
+#define		LIMIT_US		3600000000ULL	// A test that runs longer than this (simulated) is stuck
+#define		MAIN_STACK		(256 * 1024)
+
+#define		MSP430_DEFINE8(r)		volatile unsigned char r;
+#define		MSP430_DEFINE16(r)		volatile unsigned short r;
+MSP430_REGS8(MSP430_DEFINE8)
+MSP430_REGS16(MSP430_DEFINE16)
+
+char hal_info_flash[256] = {[0 ... 255] = (char)0xFF};
+int sim_flash_erases = 0;
+int sim_flash_writes_left = -1;
+unsigned int sim_adc_value = 512;
+unsigned int sim_adc_step = 0;
+unsigned int sim_adc_noise = 0;
+unsigned int sim_capture_latency = 0;
+SimSerf sim_serfs[SIM_SERFS];
+
+void samewire_main(void);
+void TIMER0_A0_ISR(void);
+void TIMER0_A1_ISR(void);
+void TIMER1_A1_ISR(void);
+void USCI0RX_ISR(void);
+void USCI0TX_ISR(void);
+void ADC10_ISR(void);
+
+static uint64_t Now = 0;				// SMCLK cycles since sim_boot()
+static uint64_t Awake = 0;				// Those spent in busy waits and delays rather than in low power mode
+static unsigned int Sr = 0;				// GIE and the low power mode bits of the running context
+static unsigned int *ExitSr = 0;		// Status register restored when the running ISR returns
+static unsigned int Ta1Frac = 0;		// SMCLK cycles not counted by TA1R yet (SMCLK/8)
+static bool bOut0 = false;				// Timer0_A OUT0, drives TXD while P1SEL selects the timer
+static bool bOut2 = false;				// Timer0_A OUT2, its rising edge starts a conversion with SHS_3
+										// The port keeps it in the OUT bit of TA0CCTL2 as well, so a write of the whole
+										// register, which resets OUT2 on the part, is seen even if the mode is set again
+static bool bBusSpace = false;
+static bool bCaOut = false;
+static uint64_t CaptureAt = 0;			// Last capture of TA0CCR1, its interrupt waits for sim_capture_latency
+
+static ucontext_t MainCtx;				// samewire_main()
+static ucontext_t TestCtx;
+static bool bInMain = false;
+static unsigned int MainSr = 0;
+static uint64_t RunUntil = 0;
+
+static char RxQueue[1024];				// Controller to firmware
+static unsigned int RxHead = 0;
+static unsigned int RxTail = 0;
+static uint64_t RxAt = 0;				// Stop bit of the next controller byte, 0 = none under way
+static char Out[65536];					// Firmware to controller
+static unsigned int OutLen = 0;
+static uint64_t OutAt = 0;				// When the last byte was complete
+static bool bTxShifting = false;
+static uint64_t TxShiftDone;
+static bool bTxBufFull = false;
+static unsigned char TxBufByte;
+static unsigned char TxShiftByte;
+
+static void *AdcBuffer = 0;				// The only buffer the firmware gives the DTC
+static unsigned int AdcCount = 0;		// Conversions since the start, every other one gets sim_adc_noise
+static uint64_t AdcAt = 0;				// End of the DTC block or the triggered conversion under way, 0 = idle
+static unsigned int AdcIndex = 0;		// Next transfer of a triggered two block DTC stream
+
+typedef struct {						// Bus interface of a serf
+	char Frame[64];						// Request being received
+	unsigned int Len;
+	uint64_t ByteAt;					// When the last request byte was complete
+	uint64_t SampleAt;					// Centre of the next bit of a request byte, 0 = waiting for a start bit
+	unsigned int Bit;
+	unsigned char Byte;
+	unsigned char Wire[128];			// Reply on the wire
+	unsigned int WireLen;
+	bool bTx;
+	bool bSpace;						// Pulling the bus to space
+	int TxBit;
+	uint64_t TxNext;
+	int GlitchByte;						// Byte of the reply with a glitch, -1 = none
+	uint64_t GlitchNext;				// Next edge of the glitch, 0 = none
+} SerfLine;
+static SerfLine Lines[SIM_SERFS];
+
+static void Fail(const char *Why)
+{
+	fprintf(stderr, "sim: %s at %llu us\n", Why, (unsigned long long)(Now / SIM_CYCLES_PER_US));
+	exit(2);
+}
+
+static unsigned int UartBitTime(void)
+{	// SMCLK cycles per controller UART bit, the modulation is left out
+	unsigned int d = UCA0BR0 | (UCA0BR1 << 8);
+	return d ? d : 1;
+}
+
+static unsigned int Crc16(const char *p, unsigned int n)
+{	// CRC-16/CCITT, bit by bit, independent of the firmware table
+	unsigned int Crc = 0xFFFF;
+	unsigned int k;
+	while (n--){
+		Crc ^= (unsigned char)*p++ << 8;
+		for (k=0;k<8;k++)
+			Crc = (Crc & 0x8000) ? ((Crc << 1) ^ 0x1021) & 0xFFFF : (Crc << 1) & 0xFFFF;
+	}
+	return Crc;
+}
+
+static bool Crossed(unsigned int Old, uint64_t Ticks, unsigned int Value)
+{	// A 16 bit counter at Old that counts Ticks passes through Value
+	return Ticks >= 0x10000 || ((Value - Old - 1) & 0xFFFF) < Ticks;
+}
+
+static uint64_t TicksTo(unsigned int From, unsigned int To)
+{	// Counts until a 16 bit counter at From next reaches To
+	unsigned int k = (To - From) & 0xFFFF;
+	return k ? k : 0x10000;
+}
+
+static void BusUpdate(void)
+{	// Bus level from the master TXD pin and the serfs, the comparator output and the start bit capture follow it
+	bool bSpace = (P1DIR & TXD) && ((P1SEL & TXD) ? bOut0 : (P1OUT & TXD) != 0);
+	bool bOut;
+	int i;
+	for (i=0;i<SIM_SERFS;i++)
+		bSpace |= Lines[i].bSpace;
+	if (bSpace != bBusSpace){
+		bBusSpace = bSpace;
+		for (i=0;i<SIM_SERFS && bSpace;i++){
+			if (sim_serfs[i].Addr && sim_serfs[i].BitTime && !Lines[i].bTx && Lines[i].SampleAt == 0){
+				Lines[i].SampleAt = Now + sim_serfs[i].BitTime / 2;	// Start bit of a request byte
+				Lines[i].Bit = 0;
+			}
+		}
+	}
+	bOut = (CACTL1 & CAON) && !bSpace;		// CAOUT high = mark
+	if (bOut != bCaOut){
+		bCaOut = bOut;
+		if ((TA0CCTL1 & CAP) && (TA0CCTL1 & (CCIS0 + CCIS1)) == CCIS_1 && (TA0CCTL1 & (bOut ? CM_1 : CM_2))){
+			if (TA0CCTL1 & CCIFG)
+				TA0CCTL1 |= COV;
+			TA0CCR1 = TA0R;
+			TA0CCTL1 |= CCIFG;
+			CaptureAt = Now;
+		}
+	}
+	CACTL2 = (CACTL2 & ~CAOUT) | (bOut ? CAOUT : 0);
+}
+
+static void Out2(bool bHigh)
+{	// Timer0_A OUT2 changes, a rising edge is the SHS_3 trigger of a single conversion
+	if (bHigh && !bOut2 && (ADC10CTL0 & ENC) && (ADC10CTL1 & SHS_3) == SHS_3 && AdcAt == 0){
+		if ((ADC10CTL1 & CONSEQ_3) != CONSEQ_2 || (ADC10CTL0 & MSC) || (ADC10DTC0 & (ADC10TB + ADC10CT)) != ADC10TB + ADC10CT
+				|| AdcBuffer == 0)
+			Fail("only a repeated single channel into a continuous two block DTC is modelled with the timer trigger");
+		AdcAt = Now + 200;
+		ADC10CTL1 |= ADC10BUSY;
+	}
+	bOut2 = bHigh;
+}
+
+static void Sync(void)
+{	// Take in what the firmware has written since time last passed
+	if (TA0CTL & TACLR){
+		TA0R = 0;
+		TA0CTL &= ~TACLR;
+	}
+	if (TA1CTL & TACLR){
+		TA1R = 0;
+		Ta1Frac = 0;
+		TA1CTL &= ~TACLR;
+	}
+	if ((TA0CCTL0 & OUTMOD_7) == OUTMOD_0)
+		bOut0 = (TA0CCTL0 & OUT) != 0;
+	Out2((TA0CCTL2 & OUT) != 0);
+	if ((ADC10CTL0 & (ENC + ADC10SC)) == ENC + ADC10SC && AdcAt == 0){
+		if ((ADC10CTL1 & SHS_3) || (ADC10DTC0 & ADC10TB) || AdcBuffer == 0)
+			Fail("only single software triggered ADC10 blocks through the DTC are modelled");
+		AdcAt = Now + 200 * (ADC10DTC1 ? ADC10DTC1 : 1);
+		ADC10CTL1 |= ADC10BUSY;
+	}
+	BusUpdate();
+}
+
+static void Compare0(unsigned int n)
+{	// Timer0_A CCRn has matched TA0R
+	volatile unsigned short *Cctl = n == 0 ? &TA0CCTL0 : n == 1 ? &TA0CCTL1 : &TA0CCTL2;
+	*Cctl |= CCIFG;
+	if (n == 2 && (*Cctl & OUTMOD_7) == OUTMOD_1){
+		*Cctl |= OUT;				// OUT2 only needs the set mode, the firmware resets it with OUTMOD_0
+		Out2(true);
+	}
+	if (n != 0)
+		return;
+	switch (*Cctl & OUTMOD_7){
+	case OUTMOD_1:
+		bOut0 = true;
+		break;
+	case OUTMOD_5:
+		bOut0 = false;
+		break;
+	case OUTMOD_2:
+	case OUTMOD_4:
+	case OUTMOD_6:
+		bOut0 = !bOut0;
+		break;
+	}
+}
+
+static void TxLoad(void)
+{	// Move UCA0TXBUF to the shift register
+	if (bTxShifting || !bTxBufFull)
+		return;
+	bTxShifting = true;
+	TxShiftByte = TxBufByte;
+	bTxBufFull = false;
+	TxShiftDone = Now + 10 * UartBitTime();
+	IFG2 |= UCA0TXIFG;
+	UCA0STAT |= UCBUSY;
+}
+
+static void SerfRequest(int i)
+{	// A complete request is in the Frame[] of serf i, answer it if it is addressed to the serf
+	SimSerf *Serf = &sim_serfs[i];
+	SerfLine *l = &Lines[i];
+	unsigned int n = l->Len;
+	unsigned int d;
+	unsigned int k;
+	char Crc[5];
+	l->Len = 0;
+	if (n < 2 || l->Frame[0] != Serf->Addr)
+		return;
+	Serf->Requests++;
+	memcpy(Serf->Request, l->Frame, n < sizeof(Serf->Request) ? n : sizeof(Serf->Request) - 1);
+	Serf->Request[n < sizeof(Serf->Request) ? n : sizeof(Serf->Request) - 1] = 0;
+	if (Serf->bCrc){
+		snprintf(Crc, sizeof(Crc), "%04X", n >= 6 ? Crc16(l->Frame, n - 5) : 0);
+		if (n < 6 || memcmp(Crc, l->Frame + n - 5, 4) != 0){
+			Serf->BadRequests++;
+			return;
+		}
+	}
+	if (Serf->Drop > 0){
+		Serf->Drop--;
+		return;
+	}
+	d = strlen(Serf->Data);
+	if (2 * d + 8 > sizeof(l->Wire))
+		Fail("serf reply too long");
+	n = 0;
+	l->Wire[n++] = Serf->Addr;
+	if (Serf->bCrc){
+		memcpy(l->Wire + n, Serf->Data, d);
+		n += d;
+		snprintf(Crc, sizeof(Crc), "%04X", Crc16((char *)l->Wire, n));
+		memcpy(l->Wire + n, Crc, 4);
+		n += 4;
+	}else if (Serf->bPlain){
+		memcpy(l->Wire + n, Serf->Data, d);
+		n += d;
+	}else{
+		for (k=0;k<2;k++){
+			l->Wire[n++] = SC;
+			memcpy(l->Wire + n, Serf->Data, d);
+			n += d;
+		}
+		l->Wire[n++] = SC;
+	}
+	l->Wire[n++] = 0x0D;
+	if (Serf->CorruptAt >= 0 && (unsigned int)Serf->CorruptAt < n)
+		l->Wire[Serf->CorruptAt] ^= 1;
+	Serf->CorruptAt = -1;
+	l->GlitchByte = Serf->GlitchAt;
+	Serf->GlitchAt = -1;
+	l->WireLen = n;
+	l->bTx = true;
+	l->TxBit = -1;
+	l->TxNext = Now + (uint64_t)Serf->DelayUs * SIM_CYCLES_PER_US;
+}
+
+static void SerfSample(int i)
+{	// Sample one bit of a request byte at the bit time of serf i
+	SerfLine *l = &Lines[i];
+	bool bMark = !bBusSpace;
+	l->SampleAt += sim_serfs[i].BitTime;
+	if (l->Bit == 0){
+		if (bMark)
+			l->SampleAt = 0;		// Glitch
+	}else if (l->Bit < 9){
+		l->Byte = (l->Byte >> 1) | (bMark ? 0x80 : 0);
+	}else{
+		l->SampleAt = 0;
+		if (!bMark){
+			l->Len = 0;				// Framing error, drop the request
+			return;
+		}
+		if (Now - l->ByteAt > SERF_IDLE_US * SIM_CYCLES_PER_US)
+			l->Len = 0;				// A new request, whatever came before was not terminated
+		l->ByteAt = Now;
+		if (l->Len < sizeof(l->Frame))
+			l->Frame[l->Len++] = l->Byte;
+		if (l->Byte == 0x0D)
+			SerfRequest(i);
+		return;
+	}
+	l->Bit++;
+}
+
+static void SerfTxEdge(int i)
+{	// Next bit of the reply of serf i
+	SerfLine *l = &Lines[i];
+	unsigned int b;
+	if (++l->TxBit == (int)(10 * l->WireLen)){
+		l->bTx = false;
+		l->bSpace = false;
+		return;
+	}
+	b = l->TxBit % 10;
+	if (b == 0)
+		l->bSpace = true;			// Start bit
+	else if (b == 9)
+		l->bSpace = false;			// Stop bit
+	else
+		l->bSpace = !((l->Wire[l->TxBit / 10] >> (b - 1)) & 1);
+	if (b == 1 && l->TxBit / 10 == l->GlitchByte)
+		l->GlitchNext = l->TxNext + sim_serfs[i].BitTime / 2 - sim_serfs[i].BitTime / 16;
+	l->TxNext += sim_serfs[i].BitTime;
+}
+
+static void SerfGlitch(int i)
+{	// An edge of the glitch, the bus flips for 1/8 bit time and the next bit edge sets it again
+	SerfLine *l = &Lines[i];
+	l->bSpace = !l->bSpace;
+	if (l->GlitchByte >= 0){
+		l->GlitchByte = -1;
+		l->GlitchNext += sim_serfs[i].BitTime / 8;
+	}else{
+		l->GlitchNext = 0;
+	}
+}
+
+static uint64_t NextEvent(void)
+{
+	uint64_t t = NEVER;
+	uint64_t k;
+	int i;
+	if (TA0CTL & MC_3){
+		if (!(TA0CCTL0 & CAP) && (k = Now + TicksTo(TA0R, TA0CCR0)) < t)
+			t = k;
+		if (!(TA0CCTL1 & CAP) && (k = Now + TicksTo(TA0R, TA0CCR1)) < t)
+			t = k;
+		if (!(TA0CCTL2 & CAP) && (k = Now + TicksTo(TA0R, TA0CCR2)) < t)
+			t = k;
+	}
+	if (TA1CTL & MC_3){
+		if (!(TA1CCTL1 & CAP) && (k = Now + 8 * TicksTo(TA1R, TA1CCR1) - Ta1Frac) < t)
+			t = k;
+		if ((k = Now + 8 * TicksTo(TA1R, 0) - Ta1Frac) < t)
+			t = k;
+	}
+	if ((TA0CCTL1 & (CCIE + CCIFG)) == CCIE + CCIFG && (k = CaptureAt + sim_capture_latency) > Now && k < t)
+		t = k;
+	if (RxAt && RxAt < t)
+		t = RxAt;
+	if (bTxShifting && TxShiftDone < t)
+		t = TxShiftDone;
+	if (AdcAt && AdcAt < t)
+		t = AdcAt;
+	for (i=0;i<SIM_SERFS;i++){
+		if (Lines[i].SampleAt && Lines[i].SampleAt < t)
+			t = Lines[i].SampleAt;
+		if (Lines[i].bTx && Lines[i].TxNext < t)
+			t = Lines[i].TxNext;
+		if (Lines[i].GlitchNext && Lines[i].GlitchNext < t)
+			t = Lines[i].GlitchNext;
+	}
+	if (bInMain && RunUntil > Now && RunUntil < t)
+		t = RunUntil;
+	return t;
+}
+
+static void Step(uint64_t d)
+{	// Let d cycles pass, d never goes past the next event
+	unsigned int Old;
+	uint64_t k;
+	unsigned int i;
+	if (TA0CTL & MC_3){
+		Old = TA0R;
+		TA0R = Old + d;
+		if (!(TA0CCTL0 & CAP) && Crossed(Old, d, TA0CCR0))
+			Compare0(0);
+		if (!(TA0CCTL1 & CAP) && Crossed(Old, d, TA0CCR1))
+			Compare0(1);
+		if (!(TA0CCTL2 & CAP) && Crossed(Old, d, TA0CCR2))
+			Compare0(2);
+	}
+	if (TA1CTL & MC_3){
+		k = Ta1Frac + d;
+		Ta1Frac = k & 7;
+		k >>= 3;
+		Old = TA1R;
+		TA1R = Old + k;
+		if (!(TA1CCTL1 & CAP) && Crossed(Old, k, TA1CCR1))
+			TA1CCTL1 |= CCIFG;
+		if (Crossed(Old, k, 0))
+			TA1CTL |= TAIFG;
+	}
+	Now += d;
+	if (Now > LIMIT_US * SIM_CYCLES_PER_US)
+		Fail("simulated time limit reached");
+	if (RxAt && RxAt <= Now){
+		if (IFG2 & UCA0RXIFG)
+			UCA0STAT |= UCOE;
+		UCA0RXBUF = RxQueue[RxTail++ % sizeof(RxQueue)];
+		IFG2 |= UCA0RXIFG;
+		RxAt = RxTail != RxHead ? RxAt + 10 * UartBitTime() : 0;
+	}
+	if (bTxShifting && TxShiftDone <= Now){
+		if (OutLen < sizeof(Out))
+			Out[OutLen++] = TxShiftByte;
+		OutAt = Now;
+		bTxShifting = false;
+		UCA0STAT &= ~UCBUSY;
+		TxLoad();
+	}
+	if (AdcAt && AdcAt <= Now && (ADC10CTL1 & SHS_3) == SHS_3){
+		((unsigned int *)AdcBuffer)[AdcIndex++] = sim_adc_value + sim_adc_step * (ADC10CTL1 >> 12) + (AdcCount++ & 1 ? sim_adc_noise : 0);
+		if (AdcIndex == ADC10DTC1){
+			ADC10DTC0 |= ADC10B1;		// Block 1 is full
+			ADC10CTL0 |= ADC10IFG;
+		}else if (AdcIndex == 2u * ADC10DTC1){
+			ADC10DTC0 &= ~ADC10B1;		// Block 2 is full, the DTC starts over
+			ADC10CTL0 |= ADC10IFG;
+			AdcIndex = 0;
+		}
+		ADC10CTL1 &= ~ADC10BUSY;
+		AdcAt = 0;
+	}
+	if (AdcAt && AdcAt <= Now){
+		for (i=0;i<(ADC10DTC1 ? ADC10DTC1 : 1);i++)	// A sequence (CONSEQ_1, CONSEQ_3) counts the input down from INCH
+			((unsigned int *)AdcBuffer)[i] = sim_adc_value + sim_adc_step * ((ADC10CTL1 >> 12) - ((ADC10CTL1 & CONSEQ_1) ? i : 0))
+					+ (AdcCount++ & 1 ? sim_adc_noise : 0);
+		ADC10MEM = sim_adc_value;
+		ADC10CTL0 = (ADC10CTL0 & ~ADC10SC) | ADC10IFG;
+		ADC10CTL1 &= ~ADC10BUSY;
+		AdcAt = 0;
+	}
+	for (i=0;i<SIM_SERFS;i++){
+		if (Lines[i].SampleAt && Lines[i].SampleAt <= Now)
+			SerfSample(i);
+		if (Lines[i].bTx && Lines[i].TxNext <= Now)
+			SerfTxEdge(i);
+		if (Lines[i].GlitchNext && Lines[i].GlitchNext <= Now)
+			SerfGlitch(i);
+	}
+	Sync();
+}
+
+static void (*Pending(void))(void)
+{	// Highest priority interrupt that is pending and enabled, its flag is cleared as the hardware does
+	if ((TA1CCTL1 & (CCIE + CCIFG)) == CCIE + CCIFG){
+		TA1CCTL1 &= ~CCIFG;
+		TA1IV = TA1IV_TACCR1;
+		return TIMER1_A1_ISR;
+	}
+	if ((TA1CTL & (TAIE + TAIFG)) == TAIE + TAIFG){
+		TA1CTL &= ~TAIFG;
+		TA1IV = TA1IV_TAIFG;
+		return TIMER1_A1_ISR;
+	}
+	if ((TA0CCTL0 & (CCIE + CCIFG)) == CCIE + CCIFG){
+		TA0CCTL0 &= ~CCIFG;
+		return TIMER0_A0_ISR;
+	}
+	if ((TA0CCTL1 & (CCIE + CCIFG)) == CCIE + CCIFG && Now >= CaptureAt + sim_capture_latency){
+		TA0CCTL1 &= ~CCIFG;
+		TA0IV = TA0IV_TACCR1;
+		return TIMER0_A1_ISR;
+	}
+	if ((TA0CCTL2 & (CCIE + CCIFG)) == CCIE + CCIFG){
+		TA0CCTL2 &= ~CCIFG;
+		TA0IV = TA0IV_TACCR2;
+		return TIMER0_A1_ISR;
+	}
+	if ((IE2 & UCA0RXIE) && (IFG2 & UCA0RXIFG)){
+		IFG2 &= ~UCA0RXIFG;			// The ISR reads UCA0RXBUF
+		return USCI0RX_ISR;
+	}
+	if ((IE2 & UCA0TXIE) && (IFG2 & UCA0TXIFG)){
+		UCA0TXBUF = TX_SENTINEL;
+		return USCI0TX_ISR;
+	}
+	if ((ADC10CTL0 & (ADC10IE + ADC10IFG)) == ADC10IE + ADC10IFG){
+		ADC10CTL0 &= ~ADC10IFG;
+		return ADC10_ISR;
+	}
+	return 0;
+}
+
+static void Dispatch(void)
+{	// Take the pending interrupts while GIE is set
+	void (*Isr)(void);
+	unsigned int Saved;
+	Sync();
+	while ((Sr & GIE) && (Isr = Pending()) != 0){
+		Saved = Sr;
+		ExitSr = &Saved;
+		Sr = 0;
+		Isr();
+		ExitSr = 0;
+		Sr = Saved;
+		if (Isr == USCI0RX_ISR)
+			UCA0STAT &= ~(UCFE + UCOE + UCPE + UCRXERR);
+		if (Isr == USCI0TX_ISR && UCA0TXBUF != TX_SENTINEL){
+			TxBufByte = UCA0TXBUF;
+			bTxBufFull = true;
+			IFG2 &= ~UCA0TXIFG;
+			TxLoad();
+		}
+		Sync();
+	}
+}
+
+static void Run(uint64_t Until, bool bSleep)
+{	// Advance to Until, or while the CPU is off with bSleep, taking interrupts on the way
+	uint64_t t;
+	while (bSleep ? (Sr & CPUOFF) != 0 : Now < Until){
+		t = NextEvent();
+		if (!bSleep && t > Until)
+			t = Until;
+		if (t == NEVER)
+			Fail("CPU off with nothing left to wake it");
+		if (!bSleep)
+			Awake += t - Now;
+		Step(t - Now);
+		Dispatch();
+		if (bInMain && Now >= RunUntil)
+			swapcontext(&MainCtx, &TestCtx);	// Time is up, back to the test
+	}
+}
+
+void hal_delay_cycles(unsigned long cycles)
+{
+	Sync();
+	Run(Now + cycles, false);
+}
+
+void hal_bis_sr(unsigned int bits)
+{
+	Sync();
+	Sr |= bits & (GIE + CPUOFF + OSCOFF + SCG0 + SCG1);
+	Dispatch();
+	if (Sr & CPUOFF)
+		Run(0, true);
+}
+
+void hal_bic_sr_on_exit(unsigned int bits)
+{
+	if (ExitSr == 0)
+		Fail("__bic_SR_register_on_exit() outside an ISR");
+	*ExitSr &= ~bits;
+}
+
+void hal_idle(void)
+{	// A busy wait, let a little time pass
+	uint64_t t;
+	Dispatch();
+	t = NextEvent();
+	if (t > Now + 64)
+		t = Now + 64;
+	Run(t, false);
+}
+
+unsigned int hal_get_sr(void)
+{
+	return Sr;
+}
+
+void hal_disable_interrupt(void)
+{
+	Sr &= ~GIE;
+}
+
+void hal_enable_interrupt(void)
+{
+	Sr |= GIE;
+	Dispatch();
+}
+
+unsigned int hal_address(void *p)
+{	// The DTC only ever gets ADCBlock[]
+	AdcBuffer = p;
+	AdcIndex = 0;
+	return 0x0200;
+}
+
+void hal_flash_erase(char *segment)
+{
+	unsigned int Off = segment - hal_info_flash;
+	if (Off >= sizeof(hal_info_flash) || (Off & 63))
+		Fail("erase outside the information segments");
+	if (Off == 0xC0)
+		Fail("erase of segment A, it holds the calibration");
+	if ((FCTL3 & LOCK) || !(FCTL1 & ERASE))
+		Fail("erase without unlocking the flash controller");
+	memset(segment, 0xFF, 64);
+	sim_flash_erases++;
+}
+
+void hal_flash_write(char *p, unsigned int w)
+{
+	unsigned int Off = p - hal_info_flash;
+	if (Off >= sizeof(hal_info_flash) || (Off & 1))
+		Fail("word program outside the information flash or at an odd address");
+	if ((FCTL3 & LOCK) || !(FCTL1 & WRT))
+		Fail("word program without unlocking the flash controller");
+	if (sim_flash_writes_left == 0)
+		return;					// Worn out or power failing, the word stays as it was
+	if (sim_flash_writes_left > 0)
+		sim_flash_writes_left--;
+	p[0] &= w;					// Programming can only clear bits
+	p[1] &= w >> 8;
+}
+
+static void MainEntry(void)
+{
+	samewire_main();
+	Fail("samewire_main() returned");
+}
+
+void sim_boot(void)
+{
+	static char Stack[MAIN_STACK];
+	int i;
+	memset(sim_serfs, 0, sizeof(sim_serfs));
+	memset(Lines, 0, sizeof(Lines));
+	for (i=0;i<SIM_SERFS;i++){
+		sim_serfs[i].DelayUs = 2000;
+		sim_serfs[i].BitTime = 1667;
+		sim_serfs[i].CorruptAt = -1;
+		sim_serfs[i].GlitchAt = -1;
+	}
+	CALBC1_16MHZ = 0x8F;
+	CALDCO_16MHZ = 0x95;
+	IFG2 = UCA0TXIFG;
+	getcontext(&MainCtx);
+	MainCtx.uc_stack.ss_sp = Stack;
+	MainCtx.uc_stack.ss_size = sizeof(Stack);
+	MainCtx.uc_link = 0;
+	makecontext(&MainCtx, MainEntry, 0);
+	sim_run(5000);
+}
+
+void sim_run(unsigned long us)
+{
+	unsigned int TestSr = Sr;
+	RunUntil = Now + (uint64_t)us * SIM_CYCLES_PER_US;
+	bInMain = true;
+	Sr = MainSr;
+	swapcontext(&TestCtx, &MainCtx);
+	MainSr = Sr;
+	Sr = TestSr | GIE;			// Firmware called from the test runs with interrupts enabled, like main() after its setup
+	bInMain = false;
+}
+
+void sim_send(const char *Text)
+{
+	while (*Text){
+		if (RxHead - RxTail == sizeof(RxQueue))
+			Fail("controller queue full");
+		if (RxAt == 0)
+			RxAt = Now + 10 * UartBitTime();
+		RxQueue[RxHead++ % sizeof(RxQueue)] = *Text++;
+	}
+}
+
+static bool Terminated(unsigned int Start)
+{	// A CR (master command) or LF (serf command) has gone out since Start, or a whole binary frame (~BM:1)
+	if (OutLen - Start >= 2 && (unsigned char)Out[Start] == 0x5A && OutLen - Start >= (unsigned char)Out[Start + 1] + 3u)
+		return true;
+	return memchr(Out + Start, 0x0D, OutLen - Start) || memchr(Out + Start, 0x0A, OutLen - Start);
+}
+
+int sim_command(const char *Cmd, char *Reply, int Size)
+{	// The reply is complete once a CR, LF or binary frame has gone out and nothing has followed for 20ms
+	unsigned int Start = OutLen;
+	uint64_t Deadline = Now + 60000000ULL * SIM_CYCLES_PER_US;
+	int n;
+	sim_send(Cmd);
+	do{
+		sim_run(1000);
+	}while (Now < Deadline && (RxAt || !Terminated(Start) || Now - OutAt < 20000 * SIM_CYCLES_PER_US));
+	n = OutLen - Start;
+	if (n > Size - 1)
+		n = Size - 1;
+	memcpy(Reply, Out + Start, n);
+	Reply[n] = 0;
+	return n;
+}
+
+unsigned int sim_out_len(void)
+{
+	return OutLen;
+}
+
+int sim_out_since(unsigned int Start, char *Text, int Size)
+{
+	int n = Start < OutLen ? OutLen - Start : 0;
+	if (n > Size)
+		n = Size;
+	memcpy(Text, Out + Start, n);
+	return n;
+}
+
+uint64_t sim_time_us(void)
+{
+	return Now / SIM_CYCLES_PER_US;
+}
+
+uint64_t sim_awake_us(void)
+{
+	return Awake / SIM_CYCLES_PER_US;
+}
+
+static int Checks = 0;
+static int Failures = 0;
+
+static void PrintEscaped(const char *s)
+{
+	for (;*s;s++){
+		if (*s == 0x0D)
+			fputs("\\r", stderr);
+		else if (*s == 0x0A)
+			fputs("\\n", stderr);
+		else if ((unsigned char)*s < 0x20 || (unsigned char)*s > 0x7E)
+			fprintf(stderr, "\\x%02X", (unsigned char)*s);
+		else
+			fputc(*s, stderr);
+	}
+}
+
+bool sim_check(bool bOK, const char *What, const char *File, int Line)
+{
+	Checks++;
+	if (!bOK){
+		Failures++;
+		fprintf(stderr, "%s:%d: check failed: %s\n", File, Line, What);
+	}
+	return bOK;
+}
+
+bool sim_expect(const char *Cmd, const char *Reply, const char *File, int Line)
+{
+	char Got[512];
+	sim_command(Cmd, Got, sizeof(Got));
+	Checks++;
+	if (strcmp(Got, Reply) == 0)
+		return true;
+	Failures++;
+	fprintf(stderr, "%s:%d: ", File, Line);
+	PrintEscaped(Cmd);
+	fputs(" replied \"", stderr);
+	PrintEscaped(Got);
+	fputs("\", expected \"", stderr);
+	PrintEscaped(Reply);
+	fputs("\"\n", stderr);
+	return false;
+}
+
+int sim_result(void)
+{
+	fprintf(stderr, "%d checks, %d failed\n", Checks, Failures);
+	return Failures ? 1 : 0;
+}
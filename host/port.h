@@ -0,0 +1,65 @@
+/*
+Host port of the Samewire master: simulated MSP430G2553, controller link and serfs
+
+port.c runs samewire_main() on a simulated 16MHz clock.  Timer0_A (bus UART, start bit capture), Timer1_A
+(time base, response timeout), the USCI_A0 controller UART, Comparator_A+, the ADC10 (single blocks, and
+the stream that OUT2 triggers into two DTC blocks) and the information flash are modelled closely enough for
+the firmware to run unmodified, and up to SIM_SERFS serfs on the bus decode the requests, each at its own bit
+time, and answer them bit by bit.
+
+A test boots the firmware with sim_boot(), then talks to it as the controller with sim_command() or
+EXPECT().  Firmware functions can also be called directly between commands, while main() sleeps.
+
+*/
+
+#ifndef PORT_H_
+#define PORT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define		SIM_CYCLES_PER_US	16
+#define		SIM_SERFS			8
+
+typedef struct {
+	char Addr;					// Address it answers to, 0 = no serf on the bus
+	bool bCrc;					// CRC-16 framing (<address><data><4 hex digits>CR), requests must carry a valid CRC as well
+	bool bPlain;				// <address><data>CR, neither redundant nor CRC framed
+	const char *Data;			// Reply data for every request
+	unsigned long DelayUs;		// From the stop bit of the request CR to the start bit of the reply
+	unsigned int BitTime;		// SMCLK cycles per bit
+	int Drop;					// Requests still to ignore (lost on the bus)
+	int CorruptAt;				// Byte of the next reply (address = 0) with bit 0 flipped on the wire, -1 = none
+	int GlitchAt;				// Byte of the next reply with a pulse of 1/8 bit time in the middle of bit 0, -1 = none
+	int Requests;				// Requests addressed to it
+	int BadRequests;			// Those that failed the CRC check and were ignored
+	char Request[48];			// Last request addressed to it, from the address up to the CR
+} SimSerf;
+
+extern SimSerf sim_serfs[SIM_SERFS];
+#define		sim_serf			(sim_serfs[0])	// The serf of the tests that need only one
+extern char hal_info_flash[256];
+extern int sim_flash_erases;		// Segment erases so far
+extern int sim_flash_writes_left;	// Word programs that still succeed, -1 = no limit
+extern unsigned int sim_adc_value;	// Result of every ADC10 conversion of input A0
+extern unsigned int sim_adc_step;	// Added for each input above A0
+extern unsigned int sim_adc_noise;	// Added to every other conversion, so the average falls between two codes
+extern unsigned int sim_capture_latency;	// SMCLK cycles from a start bit capture to its interrupt, as behind a long ISR
+
+void sim_boot(void);				// Reset the controller link and the serfs and run samewire_main() until it sleeps
+void sim_run(unsigned long us);		// Let samewire_main() run for us microseconds
+void sim_send(const char *Text);	// Queue bytes from the controller, they arrive at the controller baud rate
+int sim_command(const char *Cmd, char *Reply, int Size);	// Send Cmd, collect the reply until the link is quiet after a CR, LF or binary frame
+unsigned int sim_out_len(void);	// Bytes the controller has received since the start
+int sim_out_since(unsigned int Start, char *Text, int Size);	// Copy them from byte Start on, returns the count
+uint64_t sim_time_us(void);
+uint64_t sim_awake_us(void);		// Time the firmware spent in busy waits and delays instead of low power mode
+
+bool sim_check(bool bOK, const char *What, const char *File, int Line);
+bool sim_expect(const char *Cmd, const char *Reply, const char *File, int Line);
+int sim_result(void);				// Exit status of the test, prints the summary
+
+#define		CHECK(c)			sim_check((c), #c, __FILE__, __LINE__)
+#define		EXPECT(cmd, reply)	sim_expect((cmd), (reply), __FILE__, __LINE__)
+
+#endif /* PORT_H_ */
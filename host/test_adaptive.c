@@ -0,0 +1,54 @@
+/*
+Regression tests for the adaptive response timeout (~AE:, ~AT:, ~AP), more serfs on the bus than STATS_SLOTS
+*/
+
+#include "port.h"
+
+static void Poll(char Addr, int n)
+{
+	char Cmd[] = "?FV\r";
+	char Reply[] = "?7\r\n";
+	Cmd[0] = Reply[0] = Addr;
+	while (n--)
+		EXPECT(Cmd, Reply);
+}
+
+int main(void)
+{
+	int i;
+	sim_boot();
+	for (i=0;i<5;i++){
+		sim_serfs[i].Addr = 'A' + i;
+		sim_serfs[i].Data = "7";
+		sim_serfs[i].DelayUs = 1000 + 4000 * i;
+	}
+	sim_serfs[4].DelayUs = 1000;
+	EXPECT("~AE:1\r", "~OK\r");
+	for (i=0;i<5;i++)
+		Poll('A' + i, 16);
+	EXPECT("~AT:A\r", "~16384\r");		// ~8ms replies
+	EXPECT("~AT:B\r", "~32768\r");
+	EXPECT("~AT:D\r", "~65536\r");
+	EXPECT("~AT:E\r", "~100000\r");		// No slot left, it waits the Read Delay
+	Poll('E', 16);
+	EXPECT("~AT:A\r", "~16384\r");		// The fifth serf does not take the slot of one that has learned
+	EXPECT("~AT:E\r", "~100000\r");
+
+	// The controller hands the slot of D to E
+	EXPECT("~SX:D\r", "~OK\r");
+	EXPECT("~ST:E\r", "~OK\r");
+	EXPECT("~AT:D\r", "~100000\r");
+	Poll('D', 1);
+	Poll('E', 16);
+	EXPECT("~AT:E\r", "~16384\r");
+	EXPECT("~AT:D\r", "~100000\r");
+
+	// ~AP keeps the bins of the tracked serfs over a reset
+	EXPECT("~AP\r", "~OK\r");
+	sim_boot();
+	EXPECT("~AE\r", "~1\r");
+	EXPECT("~AT:A\r", "~16384\r");
+	EXPECT("~AT:E\r", "~16384\r");
+	EXPECT("~AT:D\r", "~100000\r");
+	return sim_result();
+}
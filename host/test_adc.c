@@ -0,0 +1,18 @@
+/*
+Regression tests for the AD measurements, the inputs read back distinct values
+*/
+
+#include "port.h"
+
+int main(void)
+{
+	sim_boot();
+	sim_adc_value = 100;
+	sim_adc_step = 10;				// Input n reads 100 + 10n
+	EXPECT("~AD:5\r", "~150\r");
+	EXPECT("~AS\r", "~210,200,130,140,150,160,170\r");	// V, T, 3-7
+	EXPECT("~AS:3V5T\r", "~210,150,200\r");
+	EXPECT("~AS:17\r", "~170\r");
+	EXPECT("~AS\r", "~210,200,130,140,150,160,170\r");	// The bare form is not changed by the scans before
+	return sim_result();
+}
@@ -0,0 +1,38 @@
+/*
+Regression tests for the batch poll (~BA:), one command to several serfs with one aggregated reply
+*/
+
+#include "port.h"
+#include <string.h>
+
+int main(void)
+{
+	sim_boot();
+	sim_serfs[0].Addr = 'A';
+	sim_serfs[0].Data = "12";
+	sim_serfs[1].Addr = 'B';
+	sim_serfs[1].Data = "345";
+	EXPECT("~BA:AB:RT\r", "~A12|B345\r");
+	CHECK(strcmp(sim_serfs[0].Request, "ART\r") == 0 && strcmp(sim_serfs[1].Request, "BRT\r") == 0);
+	EXPECT("~BA:BCA:FV\r", "~B345|CTIMEOUT|A12\r");
+	sim_serfs[1].CorruptAt = 6;		// Second copy of the data differs
+	EXPECT("~BA:AB:RT\r", "~A12|BERROR\r");
+	sim_serfs[1].Drop = 1;
+	EXPECT("~BA:B:RT\r", "~BTIMEOUT\r");
+
+	// A serf that discovery found absent is not polled
+	EXPECT("~DS:CC\r", "~\r");
+	EXPECT("~BA:ACB:RT\r", "~A12|CNOSERF|B345\r");
+
+	// Every serf reply is a frame of its own in binary mode
+	EXPECT("~BM:1\r", "~OK\r");
+	EXPECT("~BA:AB:RT\r", "\x5A\x01~\xD9" "\x5A\x03" "A12\x01" "\x5A\x04" "B345\x3C" "\x5A");	// An empty frame ends the batch
+	EXPECT("~BM:0\r", "\x5A\x03~OK\x75");
+
+	// The addresses and the command are both needed
+	EXPECT("~BA:AB\r", "~NO\r");
+	EXPECT("~BA::RT\r", "~NO\r");
+	EXPECT("~BA:AB:\r", "~NO\r");
+	CHECK(sim_serfs[0].Requests == 5 && sim_serfs[1].Requests == 6);
+	return sim_result();
+}
@@ -0,0 +1,63 @@
+/*
+Regression tests for the bus rate of ~BR:, it is only stored once a serf has answered at it
+*/
+
+#include "port.h"
+
+int main(void)
+{
+	int i;
+	sim_boot();
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "7";
+	EXPECT("~BR\r", "~00\r");
+
+	// The controller confirms 19200 on the bus, but the serf that answered at 9600 stays there
+	EXPECT("AFV\r", "A7\r\n");
+	EXPECT("~BR:01\r", "~OK\r");
+	EXPECT("~BR\r", "~01\r");
+	for (i=0;i<4;i++)
+		EXPECT("AFV\r", "\n");
+	EXPECT("~BR\r", "~00\r");		// Back to 9600 after four timeouts in a row
+	EXPECT("AFV\r", "A7\r\n");
+	sim_boot();
+	EXPECT("~BR\r", "~00\r");		// 19200 was never stored
+
+	// A serf answers at the new rate
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "7";
+	EXPECT("~BR:01\r", "~OK\r");
+	EXPECT("~BR\r", "~01\r");
+	sim_serf.BitTime = 833;
+	EXPECT("AFV\r", "A7\r\n");
+	sim_run(100000);				// main() stores it on the next tick
+	sim_boot();
+	EXPECT("~BR\r", "~01\r");
+
+	// Only the controller rate changes, it is stored right away
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "7";
+	sim_serf.BitTime = 833;
+	EXPECT("~BR:02\r", "~NO\r");		// 38400 and 57600 are not offered on the bus
+	EXPECT("~BR:11\r", "~OK\r");
+	EXPECT("~BR\r", "~11\r");
+	sim_boot();
+	EXPECT("~BR\r", "~11\r");
+
+	// Addresses that never answered do not count against the trial rate, a discovery scan finds the serf at it
+	sim_boot();
+	EXPECT("~BR:00\r", "~OK\r");
+	EXPECT("~BR\r", "~00\r");
+	sim_boot();
+	sim_serf.Addr = 'E';
+	sim_serf.Data = "7";
+	sim_serf.BitTime = 833;
+	EXPECT("~BR:01\r", "~OK\r");
+	EXPECT("~BR\r", "~01\r");
+	EXPECT("~DS:AH\r", "~E\r");
+	EXPECT("~BR\r", "~01\r");
+	sim_run(100000);
+	sim_boot();
+	EXPECT("~BR\r", "~01\r");
+	return sim_result();
+}
@@ -0,0 +1,46 @@
+/*
+Regression tests for the binary controller protocol (~BM:), frames with little endian values and a checksum
+*/
+
+#include "port.h"
+#include <string.h>
+
+static bool Frame(const char *Cmd, const char *Payload, int Len)
+{	// The reply to Cmd is BIN_SYNC, Len, Payload, the sum of the previous bytes
+	char Reply[64];
+	unsigned char Sum = 0x5A + Len;
+	int i;
+	for (i=0;i<Len;i++)
+		Sum += (unsigned char)Payload[i];
+	return sim_command(Cmd, Reply, sizeof(Reply)) == Len + 3 && Reply[0] == 0x5A && Reply[1] == Len
+		&& memcmp(Reply + 2, Payload, Len) == 0 && (unsigned char)Reply[Len + 2] == Sum;
+}
+
+int main(void)
+{
+	sim_boot();
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "7";
+	sim_adc_value = 300;
+	sim_adc_step = 10;
+
+	// ASCII until it is asked for, the reply to ~BM:1 still is
+	EXPECT("~BM\r", "~0\r");
+	EXPECT("~RD:300000\r", "~OK\r");
+	EXPECT("~BM:1\r", "~OK\r");
+	CHECK(Frame("~BM\r", "~1", 2));
+
+	// 16 and 32 bit values go out little endian without separators
+	CHECK(Frame("~AD:5\r", "~\x5E\x01", 3));
+	CHECK(Frame("~RD\r", "~\xE0\x93\x04\x00", 5));
+	CHECK(Frame("AFV\r", "A7", 2));				// A serf reply without its CR and LF
+	CHECK(Frame("~BM:2\r", "~NO", 3));
+	CHECK(Frame("~XX\r", "~", 1));				// Unknown, the ID alone
+
+	// Back to ASCII, the reply to ~BM:0 is the last frame
+	CHECK(Frame("~BM:0\r", "~OK", 3));
+	EXPECT("~BM\r", "~0\r");
+	EXPECT("~AD:5\r", "~350\r");
+	EXPECT("~RD\r", "~300000\r");
+	return sim_result();
+}
@@ -0,0 +1,99 @@
+/*
+Regression tests for the configuration store: a log of records across the information segments D, C and B
+*/
+
+#include "port.h"
+#include <stdio.h>
+#include <string.h>
+
+void ConfigInit(void);
+
+int main(void)
+{
+	char Cmd[32];
+	char Reply[32];
+	int i;
+
+	hal_info_flash[0] = (char)0xE0;	// The baseline Read Delay at D+0, 300000 busy-wait loops
+	hal_info_flash[1] = (char)0x93;
+	hal_info_flash[2] = 0x04;
+	hal_info_flash[3] = 0x00;
+	sim_boot();
+	EXPECT("~RD\r", "~100000\r");	// Written on the first boot, a loop count is not microseconds
+	EXPECT("~RP:3:25\r", "~OK\r");
+	EXPECT("~CM:A1\r", "~OK\r");
+	EXPECT("~SE:3:A:10738:RT\r", "~NO\r");	// Over half a wrap of uiTimerHigh
+	EXPECT("~SE:2:A:50:RT\r", "~OK\r");
+
+	// Every ~RD: appends a record, the log rolls over the segments and compacts the oldest one
+	for (i=0;i<200;i++){
+		snprintf(Cmd, sizeof(Cmd), "~RD:%d\r", 100001 + i);
+		EXPECT(Cmd, "~OK\r");
+	}
+	i = sim_flash_erases;
+	CHECK(i < 200 / 3);				// A segment erase for every few settings instead of one each
+	EXPECT("~RD:100200\r", "~OK\r");	// Unchanged, nothing is written
+	CHECK(sim_flash_erases == i);
+
+	ConfigInit();					// As after a reset
+	EXPECT("~RD\r", "~100200\r");
+	EXPECT("~RP\r", "~3:25\r");
+	EXPECT("~CM:A\r", "~1\r");
+	EXPECT("~SL:2\r", "~A:50:RT\r");
+	EXPECT("~SL:1\r", "~NO\r");
+	for (i=0xC0;i<0x100;i++)
+		CHECK(hal_info_flash[i] == (char)0xFF);	// Segment A is never touched
+
+	// The flash stops programming in the middle of a record
+	sim_flash_writes_left = 1;
+	EXPECT("~RD:5\r", "~NO\r");
+	sim_flash_writes_left = -1;
+	ConfigInit();
+	EXPECT("~RD\r", "~100200\r");
+	EXPECT("~RP\r", "~3:25\r");
+	EXPECT("~RD:6\r", "~OK\r");
+	ConfigInit();
+	EXPECT("~RD\r", "~6\r");
+	EXPECT("~SL:2\r", "~A:50:RT\r");
+
+	// The flash fails while the oldest segment is compacted, the records not copied yet must survive
+	for (i=0;i<60;i++){
+		sim_flash_writes_left = 3 + i % 5;
+		snprintf(Cmd, sizeof(Cmd), "~RD:%d\r", 200 + i);
+		sim_command(Cmd, Reply, sizeof(Reply));
+		sim_flash_writes_left = -1;
+		ConfigInit();
+		if (!EXPECT("~RP\r", "~3:25\r") || !EXPECT("~CM:A\r", "~1\r") || !EXPECT("~SL:2\r", "~A:50:RT\r"))
+			break;
+	}
+	EXPECT("~RD:6\r", "~OK\r");
+	ConfigInit();
+	EXPECT("~RD\r", "~6\r");
+
+	sim_command("~SE:2\r", Reply, sizeof(Reply));	// Cleared
+	EXPECT("~SL:2\r", "~NO\r");
+
+	// The age of a cached schedule reply saturates instead of wrapping
+	sim_serf.Addr = 'A';
+	sim_serf.bCrc = true;			// ~CM:A1 above
+	sim_serf.Data = "7";
+	EXPECT("~RD:100000\r", "~OK\r");	// Not the 6us above
+	EXPECT("~SE:1:A:10737:FV\r", "~OK\r");
+	sim_run(1000000);
+	sim_command("~SR:1\r", Reply, sizeof(Reply));
+	CHECK(strncmp(Reply, "~A7,", 4) == 0);
+	sim_serf.Drop = 1000000;		// Later polls fail and keep the old reply
+	sim_run(2400000000UL);			// 40 minutes, over one wrap of the 16 bit difference
+	EXPECT("~SR:1\r", "~A7,10737\r");
+
+	// A reply that ends after a Read Delay of 999999us still shows in 6 digits
+	EXPECT("~SE:1\r", "~OK\r");
+	EXPECT("~RD:999999\r", "~OK\r");
+	sim_serf.Drop = 0;
+	sim_serf.DelayUs = 990000;
+	sim_serf.Data = "0123456789";
+	EXPECT("ART\r", "A0123456789\r\n");
+	EXPECT("~LD\r", "~999999\r");
+	EXPECT("~MD\r", "~999999\r");
+	return sim_result();
+}
@@ -0,0 +1,43 @@
+/*
+Regression tests for CRC-16 framing (~CM:), the request check value and the reply check
+*/
+
+#include "port.h"
+
+unsigned int CrcUpdate(unsigned int Crc, char c);
+
+int main(void)
+{
+	const char *p;
+	unsigned int Crc = 0xFFFF;
+	for (p="123456789";*p;p++)
+		Crc = CrcUpdate(Crc, *p);
+	CHECK((Crc & 0xFFFF) == 0x29B1);	// CRC-16/CCITT check value
+
+	sim_boot();
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "456";
+	sim_serf.bCrc = true;
+	EXPECT("~CM:A\r", "~0\r");
+	EXPECT("~CM:A1\r", "~OK\r");
+	EXPECT("~CM:A\r", "~1\r");
+	EXPECT("~CM:B\r", "~0\r");
+
+	EXPECT("ART\r", "A456\r\n");
+	CHECK(sim_serf.Requests == 1 && sim_serf.BadRequests == 0);	// The request carried a valid check value
+
+	sim_serf.CorruptAt = 1;			// A'5'56<CRC>, the data no longer matches the check value
+	EXPECT("ART\r", "AERROR\r\n");
+	sim_serf.CorruptAt = 6;			// A456<CRC with a changed digit>
+	EXPECT("ART\r", "AERROR\r\n");
+	sim_serf.Data = "";				// Nothing but the check value of the address is a valid reply
+	EXPECT("ART\r", "A\r\n");
+	EXPECT("~VS\r", "~2,0,0,0,2,0\r");
+
+	EXPECT("~CM:A0\r", "~OK\r");	// Back to redundant data
+	sim_serf.bCrc = false;
+	sim_serf.Data = "456";
+	EXPECT("ART\r", "A456\r\n");
+	CHECK(sim_serf.Request[3] == 0x0D);	// No check value on the request
+	return sim_result();
+}
@@ -0,0 +1,49 @@
+/*
+Regression tests for cut-through forwarding (~CT:), a plain serf reply goes on to the controller while it arrives
+*/
+
+#include "port.h"
+#include <string.h>
+
+#define		DATA	"0123456789012345678901234567"
+
+static unsigned int Early(const char *Cmd, const char *Reply)
+{	// Bytes of the reply that are out 20ms after Cmd, while the serf is still sending
+	char Got[64];
+	unsigned int n;
+	unsigned int Start = sim_out_len();
+	sim_send(Cmd);
+	sim_run(20000);
+	n = sim_out_len() - Start;
+	sim_command("", Got, sizeof(Got));
+	CHECK(n <= strlen(Reply) && strcmp(Got, Reply + n) == 0);
+	return n;
+}
+
+int main(void)
+{
+	sim_boot();
+	sim_serf.Addr = 'A';
+	sim_serf.Data = DATA;
+	sim_serf.bPlain = true;
+	EXPECT("~CT\r", "~0\r");
+	CHECK(Early("ART\r", "A" DATA "\r\n") == 0);		// Stored and forwarded
+	EXPECT("~CT:1\r", "~OK\r");
+	EXPECT("~CT\r", "~1\r");
+	CHECK(Early("ART\r", "A" DATA "\r\n") > 4);
+	EXPECT("ART\r", "A" DATA "\r\n");
+
+	// A redundant reply is only forwarded once both copies have been compared
+	sim_serf.bPlain = false;
+	sim_serf.Data = "0123456789";
+	CHECK(Early("ART\r", "A0123456789\r\n") == 0);
+	sim_serf.CorruptAt = 14;
+	EXPECT("ART\r", "AERROR\r\n");
+
+	// A binary frame needs its length first
+	sim_serf.bPlain = true;
+	EXPECT("~BM:1\r", "~OK\r");
+	CHECK(Early("ART\r", "\x5A\x0B" "A0123456789" "\xB3") == 0);
+	EXPECT("~CT:2\r", "\x5A\x03~NO\x78");
+	return sim_result();
+}
@@ -0,0 +1,43 @@
+/*
+Regression tests for discovery (~DS:, ~DX), absent serfs fail fast with NOSERF and are probed again in the background
+*/
+
+#include "port.h"
+
+int main(void)
+{
+	uint64_t t;
+	sim_boot();
+	sim_serfs[0].Addr = 'B';
+	sim_serfs[0].Data = "7";
+	sim_serfs[1].Addr = 'D';
+	sim_serfs[1].Data = "7";
+
+	// One FV probe per address, the reply lists those that answered
+	EXPECT("~DS:AF\r", "~BD\r");
+	CHECK(sim_serfs[0].Requests == 1 && sim_serfs[1].Requests == 1);
+	CHECK(sim_serfs[0].Request[1] == 'F' && sim_serfs[0].Request[2] == 'V');
+	EXPECT("~DS:FA\r", "~NO\r");
+
+	// An absent serf does not cost a timeout
+	t = sim_time_us();
+	EXPECT("AFV\r", "ANOSERF\r\n");
+	CHECK(sim_time_us() - t < 40000);		// The request, the reply, then 20ms of quiet
+	EXPECT("BFV\r", "B7\r\n");
+
+	// A serf that turns up is found by the background probes, one absent address every ~10s
+	sim_serfs[2].Addr = 'A';
+	sim_serfs[2].Data = "7";
+	EXPECT("AFV\r", "ANOSERF\r\n");
+	sim_run(50000000);
+	CHECK(sim_serfs[2].Requests == 1);
+	EXPECT("AFV\r", "A7\r\n");
+
+	// ~DX forgets the absent ones, the next request waits for its timeout again
+	EXPECT("CFV\r", "CNOSERF\r\n");
+	EXPECT("~DX\r", "~OK\r");
+	t = sim_time_us();
+	EXPECT("CFV\r", "\n");
+	CHECK(sim_time_us() - t > 100000);
+	return sim_result();
+}
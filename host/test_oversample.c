@@ -0,0 +1,39 @@
+/*
+Regression tests for the AD oversampling (~AO:), every other conversion reads one code higher
+*/
+
+#include "port.h"
+
+int main(void)
+{
+	sim_boot();
+	sim_adc_value = 100;
+	sim_adc_noise = 1;				// The inputs average 100.5
+	EXPECT("~AO\r", "~00\r");
+	EXPECT("~AD:5\r", "~100\r");	// 16 samples, averaged
+	EXPECT("~AO:01\r", "~OK\r");
+	EXPECT("~AD:5\r", "~402\r");	// 12 bits
+	EXPECT("~AO:11\r", "~OK\r");
+	EXPECT("~AD:5\r", "~804\r");	// 13 bits from 64 samples
+	EXPECT("~AO:21\r", "~OK\r");
+	EXPECT("~AO\r", "~21\r");
+	EXPECT("~AD:5\r", "~1608\r");	// 14 bits from 256 samples
+	EXPECT("~AS:34\r", "~1608\r");	// Five inputs per sequence, input 4 reads the higher code every other time
+	EXPECT("~AO:20\r", "~OK\r");
+	EXPECT("~AD:5\r", "~100\r");
+	EXPECT("~AS:34\r", "~100\r");
+
+	// The worst case sum of 256 samples needs 18 bits
+	sim_adc_value = 1023;
+	sim_adc_noise = 0;
+	EXPECT("~AD:5\r", "~1023\r");
+	EXPECT("~AS:3V4\r", "~1023,1023\r");
+	EXPECT("~AO:21\r", "~OK\r");
+	EXPECT("~AS:3V4\r", "~16368,16368\r");
+
+	EXPECT("~AO:3\r", "~NO\r");
+	EXPECT("~AO:30\r", "~NO\r");
+	EXPECT("~AO:02\r", "~NO\r");
+	EXPECT("~AO\r", "~21\r");
+	return sim_result();
+}
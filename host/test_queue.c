@@ -0,0 +1,19 @@
+/*
+Regression tests for the controller command queue: commands pipelined behind a serf transaction
+*/
+
+#include "port.h"
+
+int main(void)
+{
+	sim_boot();
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "7";
+	// A transaction takes ~18ms at 9600, the controller sends a command every ~4ms
+	EXPECT("ART\r~FV\r", "A7\r\n~MC07\r");		// Queued while the transaction runs
+	EXPECT("ART\rART\r~FV\r", "A7\r\nA7\r\n~BUSY\r");	// No slot for the third, it is answered in its turn
+	EXPECT("ART\rART\r~FV\r~VS\r", "A7\r\nA7\r\n~BUSY\r~BUSY\r");
+	EXPECT("~FV\r", "~MC07\r");		// The queue takes commands again
+	EXPECT("~VS\r", "~5,0,0,0,0,0\r");	// The dropped ~VS never ran
+	return sim_result();
+}
@@ -0,0 +1,53 @@
+/*
+Regression tests for the serf reset (~RS[:ms]), the bus is held low in the background and ~DONE follows
+*/
+
+#include "port.h"
+#include <string.h>
+
+static uint64_t Done(unsigned long MaxUs)
+{	// Microseconds until ~DONE went out, 0 if it did not within MaxUs
+	char Out[16];
+	unsigned int Start = sim_out_len();
+	uint64_t t = sim_time_us();
+	while (sim_time_us() - t < MaxUs){
+		sim_run(1000);
+		if (sim_out_since(Start, Out, sizeof(Out)) == 6)
+			return memcmp(Out, "~DONE\r", 6) == 0 ? sim_time_us() - t : 0;
+	}
+	return 0;
+}
+
+int main(void)
+{
+	uint64_t t;
+	uint64_t Awake;
+	sim_boot();
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "7";
+
+	// The controller link stays up while the bus is held low, serf commands get BUSY
+	t = sim_time_us();
+	Awake = sim_awake_us();
+	EXPECT("~RS:200\r", "~OK\r");
+	EXPECT("AFV\r", "ABUSY\r\n");
+	EXPECT("~RS\r", "~BUSY\r");
+	EXPECT("~BR\r", "~00\r");
+	CHECK(sim_serf.Requests == 0);
+	CHECK(Done(1000000) != 0);
+	t = sim_time_us() - t;
+	CHECK(t > 200000 && t < 300000);		// Rounded up to whole 32.768ms ticks
+	CHECK(sim_awake_us() - Awake < 20000);	// No busy wait for the hold time
+	EXPECT("AFV\r", "A7\r\n");
+
+	// Five seconds without a parameter
+	EXPECT("~RS\r", "~OK\r");
+	t = Done(6000000);
+	CHECK(t > 4900000 && t < 5200000);
+	EXPECT("AFV\r", "A7\r\n");
+
+	EXPECT("~RS:0\r", "~NO\r");
+	EXPECT("~RS:60001\r", "~NO\r");
+	EXPECT("~RS:1x\r", "~NO\r");
+	return sim_result();
+}
@@ -0,0 +1,55 @@
+/*
+Regression tests for the retry policy (~RP:, ~RW:) of serf commands
+*/
+
+#include "port.h"
+
+int main(void)
+{
+	sim_boot();
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "7";
+	EXPECT("~RP\r", "~0:0\r");
+	sim_serf.Drop = 1;
+	EXPECT("AFV\r", "\n");			// No retries configured
+	CHECK(sim_serf.Requests == 1);
+
+	EXPECT("~RP:2:10\r", "~OK\r");
+	EXPECT("~RP\r", "~2:10\r");
+	EXPECT("AFV\r", "A7#1\r\n");
+	sim_serf.Drop = 1;
+	EXPECT("AFV\r", "A7#2\r\n");
+	sim_serf.Requests = 0;
+	sim_serf.Drop = 5;
+	EXPECT("AFV\r", "#3\r\n");		// First attempt and both retries lost
+	CHECK(sim_serf.Requests == 3);
+	sim_serf.Drop = 0;
+	sim_serf.CorruptAt = 4;			// A failed redundancy check is retried as well
+	EXPECT("AFV\r", "A7#2\r\n");
+
+	sim_serf.Drop = 1;				// RT is not safe to repeat until it is whitelisted
+	EXPECT("ART\r", "\n");
+	EXPECT("~RW:RTAD\r", "~OK\r");
+	EXPECT("~RW\r", "~RTAD\r");
+	sim_serf.Drop = 1;
+	EXPECT("ART\r", "A7#2\r\n");
+	sim_serf.Drop = 1;
+	EXPECT("AXX\r", "\n");
+	sim_serf.Drop = 0;
+
+	EXPECT("~RP:1:1500\r", "~OK\r");
+	sim_serf.Drop = 1;
+	EXPECT("AFV\r~FV\r", "A7#2\r\n~MC07\r");	// ~FV waits over 1.5s behind the retried transaction
+	EXPECT("~WL\r", "~999999,999999\r");
+
+	EXPECT("~RP:2:10\r", "~OK\r");
+	sim_serf.Data = "0123456789012345678901234567890123456";	// Fills SendBuf with the address and the CR
+	EXPECT("AFV\r", "A01234567890123456789012345678901234#1\r\n");	// The tail makes room for #<attempts>
+	sim_serf.Data = "7";
+
+	EXPECT("~RP:9:10001\r", "~NO\r");	// Gap above RETRY_MAX_GAP
+	EXPECT("~RP:0:0\r", "~OK\r");
+	sim_serf.Drop = 1;
+	EXPECT("AFV\r", "\n");
+	return sim_result();
+}
@@ -0,0 +1,47 @@
+/*
+Regression tests for the per serf statistics (~SH:, ~SN:, ~ST:, ~SX), more serfs on the bus than STATS_SLOTS
+*/
+
+#include "port.h"
+
+int main(void)
+{
+	int i;
+	sim_boot();
+	for (i=0;i<5;i++){
+		sim_serfs[i].Addr = 'A' + i;
+		sim_serfs[i].Data = "7";
+		sim_serfs[i].DelayUs = 1000 + 4000 * i;
+	}
+	EXPECT("FFV\r", "\n");							// Nothing answers at F, it takes no slot
+	EXPECT("~SN:F\r", "~NODATA\r");
+	EXPECT("AFV\r", "A7\r\n");
+	EXPECT("BFV\r", "B7\r\n");
+	EXPECT("CFV\r", "C7\r\n");
+	EXPECT("DFV\r", "D7\r\n");
+	EXPECT("EFV\r", "E7\r\n");
+	EXPECT("AFV\r", "A7\r\n");
+	EXPECT("~SH:A\r", "~0,0,2,0,0,0,0,0\r");		// The first four keep their slots
+	EXPECT("~SH:D\r", "~0,0,0,0,1,0,0,0\r");
+	EXPECT("~SN:D\r", "~0,0,7\r");
+	EXPECT("~SH:E\r", "~NODATA\r");
+	EXPECT("~ST:E\r", "~NO\r");
+
+	// Freeing one slot lets the next serf that answers have it
+	EXPECT("~SX:B\r", "~OK\r");
+	EXPECT("~SN:B\r", "~NODATA\r");
+	EXPECT("EFV\r", "E7\r\n");
+	EXPECT("BFV\r", "B7\r\n");
+	EXPECT("~SN:E\r", "~0,0,7\r");
+	EXPECT("~SN:B\r", "~NODATA\r");
+
+	// ~ST: keeps a slot for a serf before it answers, it counts its timeouts from then on
+	EXPECT("~SX\r", "~OK\r");
+	EXPECT("~SN:A\r", "~NODATA\r");
+	EXPECT("~ST:F\r", "~OK\r");
+	EXPECT("~ST:F\r", "~OK\r");						// Already tracked
+	EXPECT("FFV\r", "\n");
+	EXPECT("~SN:F\r", "~1,0,0\r");
+	EXPECT("~ST:\x1F\r", "~NO\r");					// Not a serf address
+	return sim_result();
+}
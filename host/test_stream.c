@@ -0,0 +1,84 @@
+/*
+Regression tests for the continuous AD stream (~AC:), Timer0_A OUT2 triggers every sample into two DTC blocks
+*/
+
+#include "port.h"
+#include <string.h>
+
+static const unsigned char *Frame(const char *Out, int n, int k)
+{	// Frame k of the stream frames in Out, 0 if there are not that many complete ones
+	const unsigned char *p = (const unsigned char *)Out;
+	while (n >= 21 && p[0] != 0xA5){
+		p++;
+		n--;
+	}
+	if (n < 21 * (k + 1))
+		return 0;
+	return p + 21 * k;
+}
+
+static bool FrameOK(const unsigned char *f, unsigned char Seq, unsigned int Value)
+{	// ADC_STREAM_SYNC, sequence, dropped, 8 samples, the samples, checksum
+	unsigned char Sum = 0;
+	int i;
+	if (f == 0 || f[0] != 0xA5 || f[1] != Seq || f[3] != 8)
+		return false;
+	for (i=0;i<20;i++)
+		Sum += f[i];
+	for (i=0;i<8;i++)
+		if ((f[4 + 2 * i] | (f[5 + 2 * i] << 8)) != Value)
+			return false;
+	return f[20] == Sum;
+}
+
+int main(void)
+{
+	char Out[256];
+	unsigned int Start;
+	uint64_t t;
+	int n;
+	sim_boot();
+	sim_adc_value = 300;
+	sim_adc_step = 10;
+
+	// 100 samples per second, a period of three CCR2 compares, one 21 byte frame every 80ms
+	t = sim_time_us();
+	EXPECT("~AC:51:100\r", "~OK\r");
+	Start = sim_out_len();
+	EXPECT("~AD:5\r", "~BUSY\r");		// The ADC belongs to the stream
+	sim_run(t + 120000 - sim_time_us());
+	n = sim_out_since(Start, Out, sizeof(Out));
+	CHECK(FrameOK(Frame(Out, n, 0), 0, 350) && Frame(Out, n, 1) == 0);
+	CHECK(Frame(Out, n, 0) != 0 && Frame(Out, n, 0)[2] == 0);	// Nothing dropped
+	sim_run(80000);
+	n = sim_out_since(Start, Out, sizeof(Out));
+	CHECK(FrameOK(Frame(Out, n, 1), 1, 350) && Frame(Out, n, 2) == 0);
+
+	// Stopping it frees the ADC, nothing follows its OK
+	EXPECT("~AC\r", "~OK\r");
+	Start = sim_out_len();
+	sim_run(200000);
+	CHECK(sim_out_len() == Start);
+	EXPECT("~AD:5\r", "~350\r");
+
+	// A rate the controller link cannot carry drops blocks and says so
+	// The link never goes quiet, so the reply is read with the stream that follows it
+	Start = sim_out_len();
+	sim_send("~AC:31:4000\r");
+	sim_run(100000);
+	n = sim_out_since(Start, Out, sizeof(Out));
+	CHECK(n > 4 && memcmp(Out, "~OK\r", 4) == 0);
+	CHECK(FrameOK(Frame(Out, n, 0), 0, 330) && FrameOK(Frame(Out, n, 1), 1, 330));
+	CHECK(Frame(Out, n, 1) != 0 && Frame(Out, n, 1)[2] > 0);
+	sim_send("~AC\r");
+	sim_run(100000);
+	Start = sim_out_len();
+	sim_run(100000);
+	CHECK(sim_out_len() == Start);
+
+	EXPECT("~AC:51:0\r", "~NO\r");
+	EXPECT("~AC:51:8001\r", "~NO\r");
+	EXPECT("~AC:54:100\r", "~NO\r");
+	EXPECT("~AC:81:100\r", "~NO\r");
+	return sim_result();
+}
@@ -0,0 +1,21 @@
+/*
+Regression tests for the controller reply ring (UartPut(), USCI0TX_ISR)
+*/
+
+#include "port.h"
+
+int main(void)
+{
+	uint64_t t;
+	sim_boot();
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "012345678901234567890123456789";
+	t = sim_awake_us();
+	EXPECT("ART\r", "A012345678901234567890123456789\r\n");	// Four times the ring, ~35ms to send at 9600
+	CHECK(sim_awake_us() - t < 2000);	// UartPut() sleeps while the ring is full
+	EXPECT("~BM:1\r", "~OK\r");
+	t = sim_awake_us();
+	EXPECT("ART\r", "\x5A\x1F" "A012345678901234567890123456789" "\xE1");
+	CHECK(sim_awake_us() - t < 2000);
+	return sim_result();
+}
@@ -0,0 +1,32 @@
+/*
+Regression tests for the redundant data validator (ReceiveByte()) and the bus receiver, through the controller link
+*/
+
+#include "port.h"
+#include <string.h>
+
+int main(void)
+{
+	sim_boot();
+	EXPECT("~FV\r", "~MC07\r");
+
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "123";
+	EXPECT("ART\r", "A123\r\n");
+	CHECK(strcmp(sim_serf.Request, "ART\r") == 0);
+
+	sim_serf.CorruptAt = 7;			// <A><SC>123<SC>1'3'3<SC><CR>, the second copy differs
+	EXPECT("ART\r", "AERROR\r\n");
+	sim_serf.CorruptAt = 9;			// The closing SC is missing
+	EXPECT("ART\r", "AERROR\r\n");
+	sim_serf.CorruptAt = 1;			// The reply does not start with an SC, so it is not redundant and the SC inside is wrong
+	EXPECT("ART\r", "AERROR\r\n");
+
+	EXPECT("BRT\r", "\n");			// Nobody at B
+
+	sim_serf.bPlain = true;			// A reply without redundancy is passed on unchecked
+	EXPECT("ART\r", "A123\r\n");
+
+	EXPECT("~VS\r", "~2,2,1,1,0,0\r");
+	return sim_result();
+}
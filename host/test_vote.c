@@ -0,0 +1,37 @@
+/*
+Regression tests for the majority vote of the bus receiver, every bit is sampled three times around its centre
+*/
+
+#include "port.h"
+
+int main(void)
+{
+	sim_boot();
+	sim_serf.Addr = 'A';
+	sim_serf.Data = "7";
+	EXPECT("AFV\r", "A7\r\n");
+
+	// A pulse shorter than the sample gap hits one sample, the other two outvote it and ~VS counts the byte
+	sim_serf.GlitchAt = 2;			// <A><SC>'7'<SC>7<SC><CR>
+	EXPECT("AFV\r", "A7\r\n");
+	EXPECT("~VS\r", "~2,0,0,0,0,1\r");
+	sim_serf.GlitchAt = 0;			// The address
+	EXPECT("AFV\r", "A7\r\n");
+	sim_serf.GlitchAt = 6;			// The CR
+	EXPECT("AFV\r", "A7\r\n");
+	EXPECT("~VS\r", "~4,0,0,0,0,3\r");
+
+	// A whole bit flipped is still an error
+	sim_serf.CorruptAt = 2;
+	EXPECT("AFV\r", "AERROR\r\n");
+	EXPECT("~VS\r", "~4,0,1,0,0,3\r");
+
+	// The same at 19200, the samples are closer together
+	EXPECT("~BR:01\r", "~OK\r");
+	sim_serf.BitTime = 833;
+	EXPECT("AFV\r", "A7\r\n");
+	sim_serf.GlitchAt = 4;
+	EXPECT("AFV\r", "A7\r\n");
+	EXPECT("~VS\r", "~6,0,1,0,0,4\r");
+	return sim_result();
+}